@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+"""Writes the golden images checked by the golden_* tests.
+
+Every expected output is computed here from the definition of the operation,
+in plain Python, without running any Fotoshoppi code, so a regression in the
+kernels cannot slip into its own golden image. Only the standard library is
+used. Run it from anywhere; it writes next to itself into golden/, or into
+the directory given as the first argument:
+
+    python3 bench/make_golden.py [directory]
+
+Then check the images by eye and commit them together with this script.
+"""
+
+import math
+import os
+import random
+import struct
+import sys
+import zlib
+
+WIDTH, HEIGHT = 128, 96
+
+
+def write_png(path, image):
+    height, width = len(image), len(image[0])
+    raw = b''.join(b'\x00' + bytes(value for pixel in row for value in pixel) for row in image)
+
+    def chunk(kind, data):
+        return struct.pack('>I', len(data)) + kind + data + struct.pack('>I', zlib.crc32(kind + data) & 0xffffffff)
+
+    with open(path, 'wb') as file:
+        file.write(b'\x89PNG\r\n\x1a\n'
+                   + chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 2, 0, 0, 0))
+                   + chunk(b'IDAT', zlib.compress(raw, 9))
+                   + chunk(b'IEND', b''))
+
+
+def source_image():
+    # Gradients, a bright square and noise, so every operation has edges and
+    # texture to work on.
+    rng = random.Random(7)
+    image = []
+    for y in range(HEIGHT):
+        row = []
+        for x in range(WIDTH):
+            noise = rng.randrange(48)
+            square = 80 if 40 <= x < 72 and 30 <= y < 62 else 0
+            red = min(255, x * 255 // WIDTH // 2 + noise + square + 100) if square else (x * 255 // WIDTH + noise) & 255
+            row.append((red, (y * 255 // HEIGHT + noise) & 255, ((x + y) * 127 // (WIDTH + HEIGHT) + noise * 2) & 255))
+        image.append(row)
+    return image
+
+
+def reference_image():
+    # The histogram matchHistogram aims for: dark, with a warm cast.
+    rng = random.Random(11)
+    image = []
+    for y in range(HEIGHT):
+        row = []
+        for x in range(WIDTH):
+            noise = rng.randrange(32)
+            row.append((min(255, x * 160 // WIDTH + noise + 40), y * 96 // HEIGHT + noise, (x * y) % 64 + noise))
+        image.append(row)
+    return image
+
+
+def clamp(value):
+    return max(0, min(255, value))
+
+
+def point(image, function):
+    return [[tuple(function(value) for value in pixel) for pixel in row] for row in image]
+
+
+def luminance(pixel):
+    return int(pixel[0] * 0.299 + pixel[1] * 0.587 + pixel[2] * 0.114)
+
+
+def rotate(image, clockwise):
+    height, width = len(image), len(image[0])
+    if clockwise:
+        return [[image[height - 1 - x][y] for x in range(height)] for y in range(width)]
+    return [[image[x][width - 1 - y] for x in range(height)] for y in range(width)]
+
+
+def zoom_out(image, step_x, step_y):
+    height, width = len(image), len(image[0])
+    result = []
+    for y in range(0, height, step_y):
+        row = []
+        for x in range(0, width, step_x):
+            block = [image[yy][xx] for yy in range(y, min(height, y + step_y)) for xx in range(x, min(width, x + step_x))]
+            row.append(tuple(sum(pixel[c] for pixel in block) // len(block) for c in range(3)))
+        result.append(row)
+    return result
+
+
+def zoom_in(image):
+    height, width = len(image), len(image[0])
+    result = [[None] * (2 * width - 1) for _ in range(2 * height - 1)]
+    for y in range(height):
+        for x in range(width):
+            result[2 * y][2 * x] = image[y][x]
+            if x + 1 < width:
+                result[2 * y][2 * x + 1] = tuple((image[y][x][c] + image[y][x + 1][c]) >> 1 for c in range(3))
+    for y in range(height - 1):
+        for x in range(2 * width - 1):
+            result[2 * y + 1][x] = tuple((result[2 * y][x][c] + result[2 * y + 2][x][c]) >> 1 for c in range(3))
+    return result
+
+
+def neighbourhood(image, function, radius, replicate):
+    # replicate: pixels outside the image repeat the nearest edge pixel;
+    # otherwise they are left out of the window.
+    height, width = len(image), len(image[0])
+    result = []
+    for y in range(height):
+        row = []
+        for x in range(width):
+            window = []
+            for yy in range(y - radius, y + radius + 1):
+                for xx in range(x - radius, x + radius + 1):
+                    if replicate:
+                        window.append(image[min(max(yy, 0), height - 1)][min(max(xx, 0), width - 1)])
+                    elif 0 <= yy < height and 0 <= xx < width:
+                        window.append(image[yy][xx])
+            row.append(tuple(function([pixel[c] for pixel in window]) for c in range(3)))
+        result.append(row)
+    return result
+
+
+def float32(value):
+    return struct.unpack('f', struct.pack('f', value))[0]
+
+
+def quantize(image, tones):
+    # Tones of the red channel split into equal intervals, each pixel taking
+    # the middle of its interval as a gray level.
+    reds = [pixel[0] for row in image for pixel in row]
+    low, high = min(reds), max(reds)
+    intervals = high - low + 1
+    if tones >= intervals:
+        return image
+    offset = float32(low - 0.5)
+    length = float32(intervals / tones)
+
+    def tone(red):
+        index = math.floor(float32(float32(red - offset) / length))
+        lower = offset + length * index
+        upper = lower + length
+        return int((lower + upper) / 2)
+
+    return [[(tone(pixel[0]),) * 3 for pixel in row] for row in image]
+
+
+def convolve(image, kernel, add):
+    # Correlation with the kernel turned by 180 degrees; the edge rows and
+    # columns are copied unchanged.
+    height, width = len(image), len(image[0])
+    increment = 127 if add else 0
+    result = [list(row) for row in image]
+    for y in range(1, height - 1):
+        for x in range(1, width - 1):
+            pixel = []
+            for c in range(3):
+                total = sum(kernel[2 - i][2 - j] * image[y - 1 + i][x - 1 + j][c] for i in range(3) for j in range(3))
+                pixel.append(clamp(int(total) + increment))
+            result[y][x] = tuple(pixel)
+    return result
+
+
+def equalize(image):
+    counts = [0] * 256
+    for row in image:
+        for pixel in row:
+            counts[luminance(pixel)] += 1
+    factor = 255.0 / (len(image) * len(image[0]))
+    table, total = [], 0.0
+    for count in counts:
+        total += factor * count
+        table.append(min(255, int(total)))
+    return point(image, lambda value: table[value])
+
+
+def match_histogram(image, reference):
+    # Each level goes to the lowest reference level whose cumulative
+    # frequency reaches its own, channel by channel.
+    result = [list(row) for row in image]
+    for c in range(3):
+        source_counts, reference_counts = [0] * 256, [0] * 256
+        for row in image:
+            for pixel in row:
+                source_counts[pixel[c]] += 1
+        for row in reference:
+            for pixel in row:
+                reference_counts[pixel[c]] += 1
+        source_total, reference_total = sum(source_counts), sum(reference_counts)
+        table, source_sum, reference_sum, level = [], 0, reference_counts[0], 0
+        for count in source_counts:
+            source_sum += count
+            target = source_sum / source_total
+            while level < 255 and reference_sum / reference_total < target:
+                level += 1
+                reference_sum += reference_counts[level]
+            table.append(level)
+        for row in result:
+            for x, pixel in enumerate(row):
+                row[x] = tuple(table[pixel[c]] if channel == c else pixel[channel] for channel in range(3))
+    return result
+
+
+PRESETS = {
+    'gaussian': ([[0.0625, 0.125, 0.0625], [0.125, 0.25, 0.125], [0.0625, 0.125, 0.0625]], False),
+    'laplacian': ([[0, -1, 0], [-1, 4, -1], [0, -1, 0]], False),
+    'highPass': ([[-1, -1, -1], [-1, 8, -1], [-1, -1, -1]], False),
+    'prewittHx': ([[-1, 0, 1], [-1, 0, 1], [-1, 0, 1]], True),
+    'prewittHy': ([[-1, -1, -1], [0, 0, 0], [1, 1, 1]], True),
+    'sobelHx': ([[-1, 0, 1], [-2, 0, 2], [-1, 0, 1]], True),
+    'sobelHy': ([[-1, -2, -1], [0, 0, 0], [1, 2, 1]], True),
+}
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), 'golden')
+    os.makedirs(directory, exist_ok=True)
+    source = source_image()
+    reference = reference_image()
+    outputs = {
+        'source': source,
+        'reference': reference,
+        'negative': point(source, lambda value: 255 - value),
+        'addBrightness': point(source, lambda value: clamp(value + 40)),
+        'addContrast': point(source, lambda value: clamp(2 * value)),
+        'grayscale': [[(luminance(pixel),) * 3 for pixel in row] for row in source],
+        'mirrorVertically': source[::-1],
+        'mirrorHorizontally': [row[::-1] for row in source],
+        'rotateRight': rotate(source, True),
+        'rotateLeft': rotate(source, False),
+        'zoomOut': zoom_out(source, 2, 2),
+        'zoomIn': zoom_in(source),
+        'boxBlur.5': neighbourhood(source, lambda values: int(sum(values) / len(values) + 0.5), 5, True),
+        'erode.1': neighbourhood(source, min, 1, False),
+        'median.5': neighbourhood(source, lambda values: sorted(values)[len(values) // 2], 5, True),
+        'quantize': quantize(source, 8),
+        'equalize': equalize(source),
+        'matchHistogram': match_histogram(source, reference),
+    }
+    for name, (kernel, add) in PRESETS.items():
+        outputs['convolve.' + name] = convolve(source, kernel, add)
+    for name, image in outputs.items():
+        write_png(os.path.join(directory, name + '.png'), image)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,167 @@
+#include "bilateral_grid.h"
+#include "kernels.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Cells are [y][x][z][value per channel..., weight], z being the intensity
+// axis.
+struct BilateralGrid {
+    int width, height, depth;
+    int fields;
+    std::vector<float> cells;
+
+    BilateralGrid(int width, int height, int depth, int fields) : width(width), height(height), depth(depth), fields(fields),
+        cells((size_t) width * height * depth * fields) {}
+
+    float *cell(int x, int y, int z) {
+        return cells.data() + (((size_t) y * width + x) * depth + z) * fields;
+    }
+};
+
+// [1 4 6 4 1] / 16 along one axis, from in to out. The grid is seen as outer
+// runs of count steps, each step a contiguous block of floats; cells beyond
+// the grid are empty, which the weight channel accounts for.
+static void blurAxis(const std::vector<float> &in, std::vector<float> &out, int outer, int count, size_t block) {
+    static const float taps[5] = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+    parallelRows(outer * count, [&](int begin, int end) {
+        for(int index = begin; index < end; index++) {
+            auto step = index % count;
+            auto target = out.data() + (size_t) index * block;
+            std::fill(target, target + block, 0.0f);
+            for(int tap = 0; tap < 5; tap++) {
+                auto neighbour = step + tap - 2;
+                if(neighbour < 0 || neighbour >= count)
+                    continue;
+                auto weight = taps[tap];
+                auto source = in.data() + (size_t) (index + tap - 2) * block;
+                for(size_t i = 0; i < block; i++)
+                    target[i] += weight * source[i];
+            }
+        }
+    });
+}
+
+// Range coordinate of every pixel: the plane itself for grayscale, the
+// luminance for colour.
+static void guideRow(const PlanarImage &source, int y, BYTE *out) {
+    if(source.channels() == 1) {
+        std::copy(source.row(0, y), source.row(0, y) + source.width(), out);
+        return;
+    }
+    kernels().luminanceRow(source.row(0, y), source.row(1, y), source.row(2, y), out, source.width());
+}
+
+// Channels is a template parameter so the per-pixel loops over a cell's
+// fields unroll.
+template<int Channels>
+static void bilateralGrid(const PlanarImage &source, PlanarImage &target, double spatialSigma, double rangeSigma) {
+    auto width = source.width();
+    auto height = source.height();
+    // At least two cells per axis, so interpolation always has a pair.
+    auto cells = [](double extent, double sigma) {
+        return std::max(2, (int) std::ceil(extent / sigma) + 1);
+    };
+    BilateralGrid grid(cells(width - 1, spatialSigma), cells(height - 1, spatialSigma), cells(255, rangeSigma), Channels + 1);
+
+    std::vector<int> cellX(width), cellZ(256);
+    for(int x = 0; x < width; x++)
+        cellX[x] = (int) std::lround(x / spatialSigma);
+    for(int level = 0; level < 256; level++)
+        cellZ[level] = (int) std::lround(level / rangeSigma);
+    // Rows splatting into grid row j are [firstRow[j], firstRow[j + 1]), so
+    // every task owns whole grid rows and no two write the same cell.
+    std::vector<int> firstRow(grid.height + 1, height);
+    for(int y = height - 1; y >= 0; y--)
+        firstRow[std::lround(y / spatialSigma)] = y;
+
+    parallelRows(grid.height, [&](int begin, int end) {
+        std::vector<BYTE> guide(width);
+        for(int y = firstRow[begin]; y < firstRow[end]; y++) {
+            auto row = (int) std::lround(y / spatialSigma);
+            guideRow(source, y, guide.data());
+            const BYTE *planes[Channels];
+            for(int channel = 0; channel < Channels; channel++)
+                planes[channel] = source.row(channel, y);
+            for(int x = 0; x < width; x++) {
+                auto cell = grid.cell(cellX[x], row, cellZ[guide[x]]);
+                for(int channel = 0; channel < Channels; channel++)
+                    cell[channel] += planes[channel][x];
+                cell[Channels] += 1;
+            }
+        }
+    });
+
+    std::vector<float> blurred(grid.cells.size());
+    constexpr size_t cellSize = Channels + 1;
+    blurAxis(grid.cells, blurred, 1, grid.height, (size_t) grid.width * grid.depth * cellSize);
+    blurAxis(blurred, grid.cells, grid.height, grid.width, grid.depth * cellSize);
+    blurAxis(grid.cells, blurred, grid.height * grid.width, grid.depth, cellSize);
+    grid.cells.swap(blurred);
+
+    // Slice: interpolate between the two grid rows around y once per image
+    // row, then bilinearly in x and z per pixel.
+    std::vector<int> lowX(width), lowZ(256);
+    std::vector<float> fractionX(width), fractionZ(256);
+    for(int x = 0; x < width; x++) {
+        auto position = x / spatialSigma;
+        lowX[x] = std::min((int) position, grid.width - 2);
+        fractionX[x] = position - lowX[x];
+    }
+    for(int level = 0; level < 256; level++) {
+        auto position = level / rangeSigma;
+        lowZ[level] = std::min((int) position, grid.depth - 2);
+        fractionZ[level] = position - lowZ[level];
+    }
+    auto rowSize = (size_t) grid.width * grid.depth * cellSize;
+    parallelRows(height, [&](int begin, int end) {
+        std::vector<BYTE> guide(width);
+        std::vector<float> slab(rowSize);
+        for(int y = begin; y < end; y++) {
+            auto position = y / spatialSigma;
+            auto low = std::min((int) position, grid.height - 2);
+            auto fraction = (float) (position - low);
+            auto top = grid.cell(0, low, 0);
+            auto bottom = grid.cell(0, low + 1, 0);
+            for(size_t i = 0; i < rowSize; i++)
+                slab[i] = top[i] + fraction * (bottom[i] - top[i]);
+            guideRow(source, y, guide.data());
+            BYTE *planes[Channels];
+            for(int channel = 0; channel < Channels; channel++)
+                planes[channel] = target.row(channel, y);
+            for(int x = 0; x < width; x++) {
+                auto level = guide[x];
+                auto near = slab.data() + ((size_t) lowX[x] * grid.depth + lowZ[level]) * cellSize;
+                auto far = near + grid.depth * cellSize;
+                auto fx = fractionX[x];
+                auto fz = fractionZ[level];
+                float sums[cellSize];
+                for(size_t field = 0; field < cellSize; field++) {
+                    auto lower = near[field] + fz * (near[field + cellSize] - near[field]);
+                    auto upper = far[field] + fz * (far[field + cellSize] - far[field]);
+                    sums[field] = lower + fx * (upper - lower);
+                }
+                // Every pixel's own splat reaches the cells around it, so the
+                // weight is positive.
+                auto scale = 1 / sums[Channels];
+                for(int channel = 0; channel < Channels; channel++)
+                    planes[channel][x] = (BYTE) std::clamp(sums[channel] * scale + 0.5f, 0.0f, 255.0f);
+            }
+        }
+    });
+}
+
+void bilateralGridPlanar(const PlanarImage &source, PlanarImage &target, double spatialSigma, double rangeSigma) {
+    spatialSigma = std::clamp(spatialSigma, BILATERAL_MIN_SPATIAL_SIGMA, BILATERAL_MAX_SPATIAL_SIGMA);
+    rangeSigma = std::clamp(rangeSigma, BILATERAL_MIN_RANGE_SIGMA, BILATERAL_MAX_RANGE_SIGMA);
+    if(source.channels() == 1)
+        bilateralGrid<1>(source, target, spatialSigma, rangeSigma);
+    else
+        bilateralGrid<DEFAULT_CHANNEL_COUNT>(source, target, spatialSigma, rangeSigma);
+}
+
+int bilateralHalo(double spatialSigma) {
+    return (int) std::ceil(3 * std::clamp(spatialSigma, BILATERAL_MIN_SPATIAL_SIGMA, BILATERAL_MAX_SPATIAL_SIGMA));
+}
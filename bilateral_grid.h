@@ -0,0 +1,29 @@
+#ifndef BILATERAL_GRID_H
+#define BILATERAL_GRID_H
+
+#include "planar_image.h"
+
+#define BILATERAL_MIN_SPATIAL_SIGMA 8.0
+#define BILATERAL_MAX_SPATIAL_SIGMA 256.0
+#define BILATERAL_DEFAULT_SPATIAL_SIGMA 16.0
+#define BILATERAL_MIN_RANGE_SIGMA 8.0
+#define BILATERAL_MAX_RANGE_SIGMA 128.0
+#define BILATERAL_DEFAULT_RANGE_SIGMA 24.0
+
+// Edge-preserving smoothing through a bilateral grid (Chen, Paris and
+// Durand). Pixels are splatted into a 3D grid with one cell per spatialSigma
+// pixels across and per rangeSigma intensity levels deep, the grid is blurred
+// with a one-cell Gaussian along each axis, and every pixel reads its result
+// back by trilinear interpolation. The cost is one splat and one slice per
+// pixel plus the grid blur, whatever the spatial sigma.
+//
+// Colour images use their luminance as the range axis for all three planes,
+// so edges stay aligned across channels. target must match the source's size
+// and channel count.
+void bilateralGridPlanar(const PlanarImage &source, PlanarImage &target, double spatialSigma, double rangeSigma);
+
+// Pixels a tile needs beyond its edge for bilateralGridPlanar to match the
+// untiled result closely.
+int bilateralHalo(double spatialSigma);
+
+#endif // BILATERAL_GRID_H
@@ -0,0 +1,217 @@
+#include "blur.h"
+#include "buffer_pool.h"
+#include "parallel.h"
+
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Rows the horizontal Gaussian pass runs side by side, and columns per
+// task of the vertical pass.
+#define GAUSSIAN_LANES 8
+#define GAUSSIAN_STRIP 64
+
+static void copyPlanes(const PlanarImage &source, PlanarImage &target) {
+    for(int channel = 0; channel < source.channels(); channel++)
+        for(int y = 0; y < source.height(); y++)
+            memcpy(target.row(channel, y), source.row(channel, y), source.width());
+}
+
+static int threadCount() {
+    return std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+}
+
+void boxBlurPlanar(const PlanarImage &source, PlanarImage &target, int radius) {
+    radius = std::clamp(radius, 0, BLUR_MAX_RADIUS);
+    if(radius == 0) {
+        copyPlanes(source, target);
+        return;
+    }
+    auto width = source.width();
+    auto lastRow = source.height() - 1;
+    auto lastColumn = width - 1;
+    auto side = 2 * radius + 1;
+    auto scale = 1.0 / ((double) side * side);
+    // Each band starts its column sums from 2 * radius + 1 rows, so use one
+    // tall band per thread.
+    auto bands = std::min(threadCount(), std::max(1, source.height() / side));
+    parallelBands(source.height(), bands, [&](int begin, int end) {
+        std::vector<quint32> columns(width);
+        for(int channel = 0; channel < source.channels(); channel++) {
+            std::fill(columns.begin(), columns.end(), 0);
+            for(int dy = -radius; dy <= radius; dy++) {
+                auto in = source.row(channel, std::clamp(begin + dy, 0, lastRow));
+                for(int x = 0; x < width; x++)
+                    columns[x] += in[x];
+            }
+            for(int y = begin; y < end; y++) {
+                if(y > begin) {
+                    auto removed = std::clamp(y - radius - 1, 0, lastRow);
+                    auto added = std::clamp(y + radius, 0, lastRow);
+                    if(removed != added) {
+                        auto out = source.row(channel, removed);
+                        auto in = source.row(channel, added);
+                        for(int x = 0; x < width; x++)
+                            columns[x] += in[x] - out[x];
+                    }
+                }
+                quint32 sum = 0;
+                for(int dx = -radius; dx <= radius; dx++)
+                    sum += columns[std::clamp(dx, 0, lastColumn)];
+                auto out = target.row(channel, y);
+                out[0] = (BYTE) (sum * scale + 0.5);
+                for(int x = 1; x < width; x++) {
+                    sum += columns[std::min(x + radius, lastColumn)] - columns[std::max(x - radius - 1, 0)];
+                    out[x] = (BYTE) (sum * scale + 0.5);
+                }
+            }
+        }
+    });
+}
+
+// Recursion state is kept in double: for large sigmas the poles sit close to
+// one and float rounding builds up into visible drift.
+struct RecursiveCoefficients {
+    double gain;
+    double feedback[3];
+    // Maps the causal pass's last three outputs, relative to the edge
+    // sample, to the anti-causal pass's initial state, as if the edge sample
+    // extended forever (Triggs and Sdika).
+    double edge[3][3];
+};
+
+// Young and van Vliet, "Recursive implementation of the Gaussian filter",
+// with the feedback terms normalised by b0.
+static RecursiveCoefficients recursiveCoefficients(double sigma) {
+    auto q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * std::sqrt(1 - 0.26891 * sigma);
+    auto q2 = q * q;
+    auto q3 = q2 * q;
+    auto b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    RecursiveCoefficients result;
+    result.feedback[0] = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    result.feedback[1] = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    result.feedback[2] = 0.422205 * q3 / b0;
+    result.gain = 1 - (result.feedback[0] + result.feedback[1] + result.feedback[2]);
+    // The edge matrix is linear in the three offsets, so find each column
+    // by running both passes past the edge with zero input until the
+    // response has died out.
+    std::vector<double> tail((size_t) std::ceil(20 * sigma) + 64);
+    for(int column = 0; column < 3; column++) {
+        double state[3] = {0, 0, 0};
+        state[column] = 1;
+        for(auto &value : tail) {
+            value = result.feedback[0] * state[0] + result.feedback[1] * state[1] + result.feedback[2] * state[2];
+            state[2] = state[1];
+            state[1] = state[0];
+            state[0] = value;
+        }
+        double future[3] = {0, 0, 0};
+        for(auto i = tail.size(); i-- > 0;) {
+            auto value = result.gain * tail[i] + result.feedback[0] * future[0] + result.feedback[1] * future[1] + result.feedback[2] * future[2];
+            future[2] = future[1];
+            future[1] = future[0];
+            future[0] = value;
+        }
+        for(int row = 0; row < 3; row++)
+            result.edge[row][column] = future[row];
+    }
+    return result;
+}
+
+// Causal then anti-causal pass over count samples spaced stride apart, lanes
+// independent sequences side by side. Both passes behave as if the edge
+// samples extended forever.
+static void recursiveLine(float *data, int count, std::ptrdiff_t stride, int lanes, const RecursiveCoefficients &c) {
+    double first[GAUSSIAN_STRIP], second[GAUSSIAN_STRIP], third[GAUSSIAN_STRIP], edge[GAUSSIAN_STRIP];
+    auto last = data + (count - 1) * stride;
+    for(int lane = 0; lane < lanes; lane++) {
+        first[lane] = second[lane] = third[lane] = data[lane];
+        edge[lane] = last[lane];
+    }
+    for(int i = 0; i < count; i++) {
+        auto line = data + i * stride;
+        for(int lane = 0; lane < lanes; lane++) {
+            auto value = c.gain * line[lane] + c.feedback[0] * first[lane] + c.feedback[1] * second[lane] + c.feedback[2] * third[lane];
+            third[lane] = second[lane];
+            second[lane] = first[lane];
+            first[lane] = value;
+            line[lane] = value;
+        }
+    }
+    for(int lane = 0; lane < lanes; lane++) {
+        double offsets[3] = {first[lane] - edge[lane], second[lane] - edge[lane], third[lane] - edge[lane]};
+        first[lane] = edge[lane] + c.edge[0][0] * offsets[0] + c.edge[0][1] * offsets[1] + c.edge[0][2] * offsets[2];
+        second[lane] = edge[lane] + c.edge[1][0] * offsets[0] + c.edge[1][1] * offsets[1] + c.edge[1][2] * offsets[2];
+        third[lane] = edge[lane] + c.edge[2][0] * offsets[0] + c.edge[2][1] * offsets[1] + c.edge[2][2] * offsets[2];
+    }
+    for(int i = count - 1; i >= 0; i--) {
+        auto line = data + i * stride;
+        for(int lane = 0; lane < lanes; lane++) {
+            auto value = c.gain * line[lane] + c.feedback[0] * first[lane] + c.feedback[1] * second[lane] + c.feedback[2] * third[lane];
+            third[lane] = second[lane];
+            second[lane] = first[lane];
+            first[lane] = value;
+            line[lane] = value;
+        }
+    }
+}
+
+void gaussianBlurPlanar(const PlanarImage &source, PlanarImage &target, double sigma) {
+    if(sigma < GAUSSIAN_MIN_SIGMA) {
+        copyPlanes(source, target);
+        return;
+    }
+    auto coefficients = recursiveCoefficients(std::min(sigma, GAUSSIAN_MAX_SIGMA));
+    auto width = source.width();
+    auto height = source.height();
+    auto buffer = BufferPool::instance().acquire((size_t) width * height * sizeof(float));
+    auto plane = (float*) buffer.get();
+    auto groups = (height + GAUSSIAN_LANES - 1) / GAUSSIAN_LANES;
+    auto strips = (width + GAUSSIAN_STRIP - 1) / GAUSSIAN_STRIP;
+    for(int channel = 0; channel < source.channels(); channel++) {
+        // Horizontal: GAUSSIAN_LANES rows interleaved, so every step of the
+        // recursion is one vector operation across the rows.
+        parallelRows(groups, [&](int begin, int end) {
+            std::vector<float> lines((size_t) width * GAUSSIAN_LANES);
+            for(int group = begin; group < end; group++) {
+                auto top = group * GAUSSIAN_LANES;
+                auto lanes = std::min(GAUSSIAN_LANES, height - top);
+                for(int lane = 0; lane < lanes; lane++) {
+                    auto in = source.row(channel, top + lane);
+                    for(int x = 0; x < width; x++)
+                        lines[(size_t) x * GAUSSIAN_LANES + lane] = in[x];
+                }
+                recursiveLine(lines.data(), width, GAUSSIAN_LANES, lanes, coefficients);
+                for(int lane = 0; lane < lanes; lane++) {
+                    auto out = plane + (size_t) (top + lane) * width;
+                    for(int x = 0; x < width; x++)
+                        out[x] = lines[(size_t) x * GAUSSIAN_LANES + lane];
+                }
+            }
+        });
+        // Vertical: rows are already contiguous, so a strip of columns is
+        // filtered in place, one vector step per row.
+        parallelBands(strips, std::min(strips, threadCount()), [&](int begin, int end) {
+            for(int strip = begin; strip < end; strip++) {
+                auto left = strip * GAUSSIAN_STRIP;
+                auto columns = std::min(GAUSSIAN_STRIP, width - left);
+                recursiveLine(plane + left, height, width, columns, coefficients);
+                for(int y = 0; y < height; y++) {
+                    auto in = plane + (size_t) y * width + left;
+                    auto out = target.row(channel, y) + left;
+                    for(int x = 0; x < columns; x++)
+                        out[x] = (BYTE) std::clamp(in[x] + 0.5f, 0.0f, 255.0f);
+                }
+            }
+        });
+    }
+}
+
+int gaussianHalo(double sigma) {
+    if(sigma < GAUSSIAN_MIN_SIGMA)
+        return 0;
+    return (int) std::ceil(4 * std::min(sigma, GAUSSIAN_MAX_SIGMA));
+}
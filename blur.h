@@ -0,0 +1,28 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include "planar_image.h"
+
+#define BLUR_MAX_RADIUS 1024
+#define GAUSSIAN_MIN_SIGMA 0.5
+#define GAUSSIAN_MAX_SIGMA 256.0
+
+// Mean of the (2 * radius + 1)^2 square around every pixel, borders
+// replicated. Column sums slide down one row at a time and a running sum
+// slides across them, so each pixel costs a fixed handful of additions
+// whatever the radius. target must match the source's size and channels.
+void boxBlurPlanar(const PlanarImage &source, PlanarImage &target, int radius);
+
+// Gaussian blur through the Young-van Vliet recursive filter: a causal and
+// an anti-causal third-order IIR pass per axis, with coefficients derived
+// from sigma, so the cost per pixel is constant. The horizontal pass runs
+// on groups of rows interleaved so the recursion vectorizes across rows;
+// the vertical pass vectorizes across columns. Sigmas below
+// GAUSSIAN_MIN_SIGMA copy the source.
+void gaussianBlurPlanar(const PlanarImage &source, PlanarImage &target, double sigma);
+
+// Pixels a tile needs beyond its edge for gaussianBlurPlanar to match the
+// untiled result to within rounding.
+int gaussianHalo(double sigma);
+
+#endif // BLUR_H
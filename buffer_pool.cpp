@@ -0,0 +1,143 @@
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <new>
+
+struct PooledImageBuffer {
+    BYTE *data;
+    size_t bucket;
+};
+
+QString BufferPoolStatistics::toString() const {
+    return QString("pool %1 hits, %2 misses, %3 MB live, %4 MB resident, %5 MB cached")
+        .arg(hits)
+        .arg(misses)
+        .arg(liveBytes / (1024.0 * 1024.0), 0, 'f', 0)
+        .arg(residentBytes / (1024.0 * 1024.0), 0, 'f', 0)
+        .arg(cachedBytes / (1024.0 * 1024.0), 0, 'f', 0);
+}
+
+BufferPool::BufferPool() {
+    bool ok = false;
+    auto megabytes = qEnvironmentVariableIntValue("FPI_POOL_MB", &ok);
+    capacity = ok && megabytes >= 0 ? (qint64) megabytes * 1024 * 1024 : DEFAULT_POOL_CAPACITY;
+}
+
+BufferPool &BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+size_t BufferPool::bucketSize(size_t bytes) {
+    bytes = std::max<size_t>(bytes, 4096);
+    size_t power = 4096;
+    while(power * 2 <= bytes)
+        power *= 2;
+    auto quarter = power / 4;
+    return (bytes + quarter - 1) / quarter * quarter;
+}
+
+BYTE *BufferPool::take(size_t bucket) {
+    {
+        QMutexLocker locker(&mutex);
+        counters.liveBytes += bucket;
+        counters.peakBytes = std::max(counters.peakBytes, counters.liveBytes);
+        auto &buffers = available[bucket];
+        if(!buffers.empty()) {
+            auto buffer = buffers.back();
+            buffers.pop_back();
+            counters.hits++;
+            counters.cachedBytes -= bucket;
+            return buffer;
+        }
+        counters.misses++;
+        counters.residentBytes += bucket;
+    }
+    return (BYTE*) ::operator new(bucket, std::align_val_t(BUFFER_ALIGNMENT));
+}
+
+void BufferPool::release(BYTE *buffer, size_t bucket) {
+    {
+        QMutexLocker locker(&mutex);
+        counters.liveBytes -= bucket;
+        if(counters.cachedBytes + (qint64) bucket <= capacity) {
+            available[bucket].push_back(buffer);
+            counters.cachedBytes += bucket;
+            return;
+        }
+        counters.residentBytes -= bucket;
+    }
+    ::operator delete(buffer, std::align_val_t(BUFFER_ALIGNMENT));
+}
+
+std::shared_ptr<BYTE> BufferPool::acquire(size_t bytes) {
+    auto bucket = bucketSize(bytes);
+    return std::shared_ptr<BYTE>(take(bucket), [this, bucket](BYTE *buffer) {
+        release(buffer, bucket);
+    });
+}
+
+QImage BufferPool::image(int width, int height, QImage::Format format) {
+    auto bytesPerLine = ((qint64) QImage::toPixelFormat(format).bitsPerPixel() * width + 31) / 32 * 4;
+    auto bucket = bucketSize(std::max<qint64>(1, bytesPerLine * height));
+    auto buffer = new PooledImageBuffer{take(bucket), bucket};
+    return QImage(buffer->data, width, height, bytesPerLine, format, [](void *info) {
+        auto buffer = (PooledImageBuffer*) info;
+        BufferPool::instance().release(buffer->data, buffer->bucket);
+        delete buffer;
+    }, buffer);
+}
+
+QImage BufferPool::copy(const QImage &source) {
+    return copy(source, source.rect());
+}
+
+QImage BufferPool::copy(const QImage &source, QRect rect) {
+    rect = rect.intersected(source.rect());
+    auto result = image(rect.width(), rect.height(), source.format());
+    auto offset = (qsizetype) rect.left() * source.depth() / 8;
+    auto rowBytes = ((qsizetype) rect.width() * source.depth() + 7) / 8;
+    auto out = result.bits();
+    auto outStride = result.bytesPerLine();
+    for(int y = 0; y < rect.height(); y++)
+        memcpy(out + y * outStride, source.constScanLine(rect.top() + y) + offset, rowBytes);
+    if(source.format() == QImage::Format_Indexed8)
+        result.setColorTable(source.colorTable());
+    return result;
+}
+
+BufferPoolStatistics BufferPool::statistics() {
+    QMutexLocker locker(&mutex);
+    return counters;
+}
+
+void BufferPool::setCapacity(qint64 bytes) {
+    {
+        QMutexLocker locker(&mutex);
+        capacity = bytes;
+    }
+    trim();
+}
+
+qint64 BufferPool::resetPeak() {
+    QMutexLocker locker(&mutex);
+    counters.peakBytes = counters.liveBytes;
+    return counters.liveBytes;
+}
+
+void BufferPool::trim() {
+    std::vector<BYTE*> released;
+    {
+        QMutexLocker locker(&mutex);
+        for(auto &bucket : available) {
+            for(auto buffer : bucket.second) {
+                released.push_back(buffer);
+                counters.cachedBytes -= bucket.first;
+                counters.residentBytes -= bucket.first;
+            }
+            bucket.second.clear();
+        }
+    }
+    for(auto buffer : released)
+        ::operator delete(buffer, std::align_val_t(BUFFER_ALIGNMENT));
+}
@@ -0,0 +1,61 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "definitions.h"
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#define BUFFER_ALIGNMENT 64
+#define DEFAULT_POOL_CAPACITY (1024LL * 1024 * 1024)
+
+struct BufferPoolStatistics {
+    quint64 hits = 0, misses = 0;
+    qint64 residentBytes = 0;
+    qint64 cachedBytes = 0;
+    // Bytes handed out and not yet released, and their high-water mark
+    // since the last resetPeak().
+    qint64 liveBytes = 0;
+    qint64 peakBytes = 0;
+
+    QString toString() const;
+};
+
+// Size-bucketed pool of BUFFER_ALIGNMENT aligned buffers for intermediate
+// images. Released buffers are kept for reuse up to the pool capacity, so
+// repeated operations on the same image size do not go back to malloc.
+class BufferPool {
+public:
+    static BufferPool &instance();
+
+    std::shared_ptr<BYTE> acquire(size_t bytes);
+    QImage image(int width, int height, QImage::Format format);
+    QImage copy(const QImage &source);
+    QImage copy(const QImage &source, QRect rect);
+
+    BufferPoolStatistics statistics();
+    void setCapacity(qint64 bytes);
+    void trim();
+    // Restarts the high-water mark from the bytes live now, which it
+    // returns.
+    qint64 resetPeak();
+
+private:
+    QMutex mutex;
+    std::map<size_t, std::vector<BYTE*>> available;
+    BufferPoolStatistics counters;
+    qint64 capacity;
+
+    BufferPool();
+
+    static size_t bucketSize(size_t bytes);
+    BYTE *take(size_t bucket);
+    void release(BYTE *buffer, size_t bucket);
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,106 @@
+#include "clahe.h"
+#include "definitions.h"
+#include "kernels.h"
+#include "parallel.h"
+
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static void tileLookup(const QImage &image, QRect tile, double clipLimit, BYTE *lookup) {
+    quint32 histogram[256] = {};
+    if(image.format() == QImage::Format_Grayscale8) {
+        for(int y = tile.top(); y <= tile.bottom(); y++) {
+            auto gray = image.constScanLine(y);
+            for(int x = tile.left(); x <= tile.right(); x++)
+                histogram[gray[x]]++;
+        }
+    } else {
+        for(int y = tile.top(); y <= tile.bottom(); y++) {
+            auto pixels = (const QRgb*) image.constScanLine(y);
+            for(int x = tile.left(); x <= tile.right(); x++)
+                histogram[(int) (qRed(pixels[x]) * 0.299 + qGreen(pixels[x]) * 0.587 + qBlue(pixels[x]) * 0.114)]++;
+        }
+    }
+    auto pixels = (quint64) tile.width() * tile.height();
+    auto limit = std::max<quint64>(1, clipLimit * pixels / 256);
+    quint64 excess = 0;
+    for(auto &count : histogram) {
+        if(count > limit) {
+            excess += count - limit;
+            count = limit;
+        }
+    }
+    // Spread the clipped counts evenly, the remainder one per bin from the
+    // bottom, so the histogram still sums to the tile's pixel count.
+    auto share = excess / 256;
+    auto remainder = excess % 256;
+    quint64 sum = 0;
+    for(int i = 0; i < 256; i++) {
+        sum += histogram[i] + share + (i < (int) remainder ? 1 : 0);
+        lookup[i] = std::min<quint64>(255, (sum * 255 + pixels / 2) / pixels);
+    }
+}
+
+void clahe(QImage &image, QRect rect, ClaheSettings settings) {
+    rect = rect.intersected(image.rect());
+    if(rect.isEmpty())
+        return;
+    auto tilesX = std::clamp(settings.tilesX, 1, rect.width());
+    auto tilesY = std::clamp(settings.tilesY, 1, rect.height());
+    auto tileWidth = (rect.width() + tilesX - 1) / tilesX;
+    auto tileHeight = (rect.height() + tilesY - 1) / tilesY;
+    tilesX = (rect.width() + tileWidth - 1) / tileWidth;
+    tilesY = (rect.height() + tileHeight - 1) / tileHeight;
+
+    std::vector<BYTE> lookups((size_t) tilesX * tilesY * 256);
+    QList<int> tiles;
+    for(int i = 0; i < tilesX * tilesY; i++)
+        tiles << i;
+    QtConcurrent::blockingMap(tiles, [&](int index) {
+        auto column = index % tilesX;
+        auto row = index / tilesX;
+        auto tile = QRect(rect.left() + column * tileWidth, rect.top() + row * tileHeight, tileWidth, tileHeight).intersected(rect);
+        tileLookup(image, tile, settings.clipLimit, lookups.data() + (size_t) index * 256);
+    });
+
+    // Columns share their tile pair and weight across rows, so those are
+    // computed once. Weights are 8-bit fixed point.
+    std::vector<std::int32_t> left(rect.width()), right(rect.width());
+    std::vector<std::uint16_t> weights(rect.width());
+    auto locate = [](int position, int size, int count, int &first, int &second) {
+        auto center = (position + 0.5) / size - 0.5;
+        first = std::clamp((int) std::floor(center), 0, count - 1);
+        second = std::min(first + 1, count - 1);
+        return (int) std::lround(std::clamp(center - first, 0.0, 1.0) * 256);
+    };
+    for(int x = 0; x < rect.width(); x++) {
+        int first, second;
+        weights[x] = locate(x, tileWidth, tilesX, first, second);
+        left[x] = first * 256;
+        right[x] = second * 256;
+    }
+    auto claheRow = kernels().claheRow;
+    auto claheGrayRow = kernels().claheGrayRow;
+    auto gray = image.format() == QImage::Format_Grayscale8;
+    // Detach on this thread; scanLine() in the workers would race on a
+    // shared image.
+    auto stride = image.bytesPerLine();
+    auto pixels = image.bits() + rect.top() * stride;
+    parallelRows(rect.height(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++) {
+            int top, bottom;
+            auto weight = locate(y, tileHeight, tilesY, top, bottom);
+            if(gray)
+                claheGrayRow(pixels + y * stride + rect.left(), rect.width(),
+                             lookups.data() + (size_t) top * tilesX * 256, lookups.data() + (size_t) bottom * tilesX * 256,
+                             left.data(), right.data(), weights.data(), weight);
+            else
+                claheRow((QRgb*) (pixels + y * stride) + rect.left(), rect.width(),
+                     lookups.data() + (size_t) top * tilesX * 256, lookups.data() + (size_t) bottom * tilesX * 256,
+                     left.data(), right.data(), weights.data(), weight);
+        }
+    });
+}
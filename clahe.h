@@ -0,0 +1,24 @@
+#ifndef CLAHE_H
+#define CLAHE_H
+
+#include <QImage>
+#include <QRect>
+
+#define CLAHE_DEFAULT_TILES 8
+#define CLAHE_DEFAULT_CLIP_LIMIT 2.0
+
+struct ClaheSettings {
+    int tilesX = CLAHE_DEFAULT_TILES;
+    int tilesY = CLAHE_DEFAULT_TILES;
+    // Multiple of the average bin height a tile histogram is clipped to.
+    double clipLimit = CLAHE_DEFAULT_CLIP_LIMIT;
+};
+
+// Contrast limited adaptive histogram equalization of the rectangle, in
+// place. Each tile gets its own clipped luminance histogram and lookup
+// table; every pixel blends the tables of the four nearest tile centres.
+// Like equalize(), the luminance mapping is applied to each channel;
+// Format_Grayscale8 images are mapped directly.
+void clahe(QImage &image, QRect rect, ClaheSettings settings);
+
+#endif // CLAHE_H
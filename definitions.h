@@ -5,6 +5,20 @@
 
 #define DEFAULT_CHANNEL_COUNT 3
 
+#define TILE_SIZE 512
+#define TILED_PIXEL_THRESHOLD (256LL * 1024 * 1024)
+#define TILED_PREVIEW_SIZE 2048
+#define DEFAULT_MEMORY_BUDGET (2048LL * 1024 * 1024)
+#define PREVIEW_DECODE_SIZE 1024
+
 typedef std::uint8_t BYTE;
 
+const double GAUSSIAN[3][3] = {{0.0625, 0.125, 0.0625}, {0.125, 0.25, 0.125}, {0.0625, 0.125, 0.0625}};
+const double LAPLACIAN[3][3] = {{0, -1, 0}, {-1, 4, -1}, {0, -1, 0}};
+const double HIGH_PASS[3][3] = {{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}};
+const double PREWITT_HX[3][3] = {{-1, 0, 1}, {-1, 0, 1}, {-1, 0, 1}};
+const double PREWITT_HY[3][3] = {{-1, -1, -1}, {0, 0, 0}, {1, 1, 1}};
+const double SOBEL_HX[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
+const double SOBEL_HY[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
+
 #endif // DEFINITIONS_H
@@ -0,0 +1,63 @@
+#include "encoder.h"
+#include "raw_image.h"
+
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+
+QThreadPool *ImageEncoder::pool() {
+    static QThreadPool *encoders = [] {
+        auto result = new QThreadPool;
+        result->setMaxThreadCount(std::max(1, QThread::idealThreadCount() / 2));
+        return result;
+    }();
+    return encoders;
+}
+
+static bool isLossy(QByteArray format) {
+    return format == "jpg" || format == "jpeg" || format == "webp";
+}
+
+EncoderSettings ImageEncoder::settingsFor(QString path, int quality, int compression) {
+    EncoderSettings settings;
+    auto suffix = QFileInfo(path).suffix().toLower();
+    settings.format = suffix.isEmpty() ? QByteArray("jpg") : suffix.toLatin1();
+    // Qt's PNG writer turns quality into a zlib level, so a JPEG-style
+    // quality of 90 would store PNGs almost uncompressed. Quality therefore
+    // only applies to lossy formats and compression to lossless ones.
+    if(isLossy(settings.format))
+        settings.quality = quality;
+    if(settings.format == "png")
+        settings.compression = compression >= 0 ? std::min(compression, 9) : PNG_DEFAULT_COMPRESSION;
+    if(settings.format == "tif" || settings.format == "tiff")
+        settings.compression = compression >= 0 ? std::min(compression, 1) : 1;
+    settings.progressive = settings.format == "jpg" || settings.format == "jpeg";
+    return settings;
+}
+
+bool ImageEncoder::encode(QImage image, QString path, EncoderSettings settings) {
+    if(RawImage::isRawImage(path))
+        return RawImage::save(path, image);
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    QImageWriter writer(&file, settings.format);
+    if(settings.quality >= 0)
+        writer.setQuality(settings.quality);
+    if(settings.compression >= 0)
+        writer.setCompression(settings.compression);
+    writer.setProgressiveScanWrite(settings.progressive);
+    writer.setOptimizedWrite(true);
+    if(!writer.write(image)) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+QFuture<bool> ImageEncoder::encodeAsync(QImage image, QString path, EncoderSettings settings) {
+    return QtConcurrent::run(pool(), encode, image, path, settings);
+}
@@ -0,0 +1,33 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <QFuture>
+#include <QImage>
+#include <QString>
+#include <QThreadPool>
+
+// zlib level used for PNG when none is given; 6 is zlib's own default.
+#define PNG_DEFAULT_COMPRESSION 6
+
+struct EncoderSettings {
+    QByteArray format;
+    int quality = -1;
+    int compression = -1;
+    bool progressive = false;
+};
+
+// Saves run on a dedicated pool so the GUI thread never waits on an encoder.
+// QImage is implicitly shared, so the encoder keeps its own snapshot while
+// editing continues. Files are written to a temporary and renamed on success.
+class ImageEncoder {
+public:
+    static QThreadPool *pool();
+    // quality (0-100) applies to lossy formats only. compression is the
+    // zlib level (0-9) for PNG and 0 or 1 (none or LZW) for TIFF; -1 picks
+    // the format's default.
+    static EncoderSettings settingsFor(QString path, int quality, int compression = -1);
+    static bool encode(QImage image, QString path, EncoderSettings settings);
+    static QFuture<bool> encodeAsync(QImage image, QString path, EncoderSettings settings);
+};
+
+#endif // ENCODER_H
@@ -0,0 +1,345 @@
+#include "image_widget.cpp"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QThreadPool>
+
+struct BenchOperation {
+    QString name;
+    std::function<void(ImageWidget*)> run;
+};
+
+struct BenchResult {
+    QString operation;
+    double megapixels;
+    int threads;
+    qint64 nanoseconds;
+    double nsPerPixel;
+    double megapixelsPerSecond;
+    double speedup;
+};
+
+static QImage syntheticImage(double megapixels, quint32 seed) {
+    int width = std::max(1, (int) std::sqrt(megapixels * 1e6 * 4 / 3));
+    int height = std::max(1, (int) (megapixels * 1e6 / width));
+    QImage result(width, height, QImage::Format_RGB32);
+    QRandomGenerator random(seed);
+    for(int y = 0; y < height; y++) {
+        auto line = (QRgb*) result.scanLine(y);
+        for(int x = 0; x < width; x++) {
+            auto noise = random.bounded(32);
+            line[x] = qRgb((x * 255 / width + noise) & 255, (y * 255 / height + noise) & 255, ((x + y) * 127 / (width + height) + noise) & 255);
+        }
+    }
+    return result;
+}
+
+static QList<BenchOperation> operations(QImage reference) {
+    QList<BenchOperation> result = {
+        {"grayscale", [](ImageWidget *widget) { widget->grayscale(); }},
+        {"addBrightness", [](ImageWidget *widget) { widget->addBrightness(40); }},
+        {"addContrast", [](ImageWidget *widget) { widget->addContrast(2); }},
+        {"negative", [](ImageWidget *widget) { widget->negative(); }},
+        {"quantize", [](ImageWidget *widget) { widget->quantize(8); }},
+        {"quantizeColors", [](ImageWidget *widget) { widget->quantizeColors(64); }},
+        {"histogram", [](ImageWidget *widget) { widget->histogram(); }},
+        {"statistics", [](ImageWidget *widget) { widget->statistics(); }},
+        {"equalize", [](ImageWidget *widget) { widget->equalize(); }},
+        {"equalizeAdaptive", [](ImageWidget *widget) { widget->equalizeAdaptive(CLAHE_DEFAULT_CLIP_LIMIT); }},
+        {"median.5", [](ImageWidget *widget) { widget->median(5); }},
+        {"median.25", [](ImageWidget *widget) { widget->median(25); }},
+        {"boxBlur.5", [](ImageWidget *widget) { widget->boxBlur(5); }},
+        {"boxBlur.50", [](ImageWidget *widget) { widget->boxBlur(50); }},
+        {"gaussianBlur.2", [](ImageWidget *widget) { widget->gaussianBlur(2); }},
+        {"gaussianBlur.50", [](ImageWidget *widget) { widget->gaussianBlur(50); }},
+        {"erode.1", [](ImageWidget *widget) { widget->morphology(MorphologyOperation::Erode, 1, 1); }},
+        {"erode.50", [](ImageWidget *widget) { widget->morphology(MorphologyOperation::Erode, 50, 50); }},
+        {"topHat.15", [](ImageWidget *widget) { widget->morphology(MorphologyOperation::TopHat, 15, 15); }},
+        {"bilateral.16", [](ImageWidget *widget) { widget->bilateral(16, 24); }},
+        {"bilateral.64", [](ImageWidget *widget) { widget->bilateral(64, 24); }},
+        {"compare", [](ImageWidget *widget) { widget->compare(widget->getImage()); }},
+        {"differenceHeatmap", [](ImageWidget *widget) { widget->differenceHeatmap(widget->getImage()); }},
+        {"matchHistogram", [reference](ImageWidget *widget) { widget->matchHistogram(reference); }},
+        {"mirrorVertically", [](ImageWidget *widget) { widget->mirrorVertically(); }},
+        {"mirrorHorizontally", [](ImageWidget *widget) { widget->mirrorHorizontally(); }},
+        {"rotateLeft", [](ImageWidget *widget) { widget->rotateLeft(); }},
+        {"rotateRight", [](ImageWidget *widget) { widget->rotateRight(); }},
+        {"zoomOut", [](ImageWidget *widget) { widget->zoomOut(2, 2); }},
+        {"zoomIn", [](ImageWidget *widget) { widget->zoomIn(); }},
+        {"grayscalePipeline", [reference](ImageWidget *widget) {
+            double kernel[3][3];
+            memcpy(kernel, GAUSSIAN, sizeof(kernel));
+            widget->grayscale();
+            widget->equalize();
+            widget->matchHistogram(reference);
+            widget->quantize(8);
+            widget->convolve(kernel, false);
+        }},
+    };
+    const QStringList presetNames = {"gaussian", "laplacian", "highPass", "prewittHx", "prewittHy", "sobelHx", "sobelHy"};
+    const double (*presets[])[3] = {GAUSSIAN, LAPLACIAN, HIGH_PASS, PREWITT_HX, PREWITT_HY, SOBEL_HX, SOBEL_HY};
+    for(int i = 0; i < presetNames.size(); i++) {
+        auto preset = presets[i];
+        auto add = i >= 3;
+        result << BenchOperation{"convolve." + presetNames[i], [preset, add](ImageWidget *widget) {
+            double kernel[3][3];
+            memcpy(kernel, preset, sizeof(kernel));
+            widget->convolve(kernel, add);
+        }};
+    }
+    return result;
+}
+
+static qint64 measure(const BenchOperation &operation, QImage source, int repetitions) {
+    QList<qint64> samples;
+    for(int i = 0; i < repetitions; i++) {
+        auto widget = ImageWidget::createHeadless(source);
+        QElapsedTimer timer;
+        timer.start();
+        operation.run(widget);
+        samples << timer.nsecsElapsed();
+        delete widget;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+static QImage runOnce(const BenchOperation &operation, QImage source) {
+    auto widget = ImageWidget::createHeadless(source);
+    operation.run(widget);
+    auto result = widget->getImage().convertToFormat(QImage::Format_RGB32);
+    delete widget;
+    return result;
+}
+
+static int maxChannelDifference(QImage first, QImage second) {
+    if(first.size() != second.size())
+        return 256;
+    int result = 0;
+    for(int y = 0; y < first.height(); y++) {
+        auto a = (const QRgb*) first.constScanLine(y);
+        auto b = (const QRgb*) second.constScanLine(y);
+        for(int x = 0; x < first.width(); x++) {
+            result = std::max(result, std::abs(qRed(a[x]) - qRed(b[x])));
+            result = std::max(result, std::abs(qGreen(a[x]) - qGreen(b[x])));
+            result = std::max(result, std::abs(qBlue(a[x]) - qBlue(b[x])));
+        }
+    }
+    return result;
+}
+
+static int checkGolden(QList<BenchOperation> operations, QImage source, QString directory, bool record, int tolerance) {
+    QDir dir(directory);
+    if(record)
+        dir.mkpath(".");
+    int failures = 0;
+    for(auto &operation : operations) {
+        auto output = runOnce(operation, source);
+        auto path = dir.filePath(operation.name + ".png");
+        if(record) {
+            output.save(path);
+            continue;
+        }
+        auto difference = maxChannelDifference(output, QImage(path).convertToFormat(QImage::Format_RGB32));
+        auto passed = difference <= tolerance;
+        if(!passed)
+            failures++;
+        QTextStream(stdout) << (passed ? "PASS " : "FAIL ") << operation.name << " (max difference " << difference << ")\n";
+    }
+    return failures;
+}
+
+// Regression mode: every reference/test pair on one CSV line. Fails when a
+// pair differs in size or scores below minimumSsim.
+static int comparePairs(QStringList paths, QString heatmapDirectory, double minimumSsim) {
+    if(paths.isEmpty() || paths.size() % 2 != 0) {
+        QTextStream(stderr) << "--compare needs reference and test images in pairs\n";
+        return 1;
+    }
+    QDir heatmaps(heatmapDirectory);
+    if(!heatmapDirectory.isEmpty())
+        heatmaps.mkpath(".");
+    QTextStream out(stdout);
+    out << "reference,test,mse,psnr,ssim\n";
+    int failures = 0;
+    for(int i = 0; i < paths.size(); i += 2) {
+        auto reference = decodeImageUncached(paths[i]);
+        auto test = decodeImageUncached(paths[i + 1]);
+        auto comparison = compareImages(reference, test);
+        if(!comparison.isValid() || comparison.ssim() < minimumSsim)
+            failures++;
+        out << QString("%1,%2,%3,%4,%5\n").arg(paths[i], paths[i + 1]).arg(comparison.mse()).arg(comparison.psnr()).arg(comparison.ssim());
+        if(!heatmapDirectory.isEmpty() && comparison.isValid())
+            differenceHeatmap(reference, test).save(heatmaps.filePath(QString("%1_%2.png").arg(i / 2).arg(QFileInfo(paths[i + 1]).baseName())));
+    }
+    out.flush();
+    return failures;
+}
+
+static QString resultKey(QString operation, double megapixels, int threads) {
+    return QString("%1/%2/%3").arg(operation).arg(megapixels, 0, 'f', 1).arg(threads);
+}
+
+static int checkBaseline(QList<BenchResult> results, QString path, double margin) {
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream(stderr) << "Could not open baseline " << path << "\n";
+        return 1;
+    }
+    QMap<QString, double> baseline;
+    QTextStream in(&file);
+    in.readLine();
+    while(!in.atEnd()) {
+        auto fields = in.readLine().split(',');
+        if(fields.size() >= 6)
+            baseline[resultKey(fields[0], fields[1].toDouble(), fields[2].toInt())] = fields[5].toDouble();
+    }
+    int failures = 0;
+    for(auto &result : results) {
+        auto key = resultKey(result.operation, result.megapixels, result.threads);
+        if(!baseline.contains(key))
+            continue;
+        auto minimum = baseline[key] * (1 - margin);
+        if(result.megapixelsPerSecond >= minimum)
+            continue;
+        failures++;
+        QTextStream(stderr) << "REGRESSION " << key << ": " << result.megapixelsPerSecond << " MP/s, baseline " << baseline[key] << " MP/s\n";
+    }
+    return failures;
+}
+
+static QList<int> threadCounts(int maximum) {
+    QList<int> result;
+    for(int threads = 1; threads < maximum; threads *= 2)
+        result << threads;
+    result << maximum;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("fpi_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks every ImageWidget operation over synthetic images.\nSet FPI_ISA=baseline|sse4.2|avx2|avx512 to force a kernel ISA level.");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption("sizes", "Comma separated image sizes in megapixels.", "list", "0.3,1,3,12,24,50,100");
+    QCommandLineOption threadsOption("threads", "Comma separated thread counts (default: powers of two up to the core count).", "list");
+    QCommandLineOption opsOption("ops", "Comma separated operation names to run (default: all).", "list");
+    QCommandLineOption repeatOption("repeat", "Repetitions per measurement, the median is reported.", "count", "3");
+    QCommandLineOption formatOption("format", "Output format: csv or json.", "format", "csv");
+    QCommandLineOption outputOption("output", "Write results to a file instead of stdout.", "file");
+    QCommandLineOption recordGoldenOption("record-golden", "Write the output of every operation to a directory of golden images.", "directory");
+    QCommandLineOption checkGoldenOption("check-golden", "Compare the output of every operation against a directory of golden images.", "directory");
+    QCommandLineOption goldenSizeOption("golden-size", "Image size in megapixels used for golden images.", "megapixels", "0.3");
+    QCommandLineOption goldenSourceOption("golden-source", "Image file used for golden images instead of a synthetic one.", "file");
+    QCommandLineOption goldenReferenceOption("golden-reference", "Image file matchHistogram matches golden images to instead of a synthetic one.", "file");
+    QCommandLineOption toleranceOption("tolerance", "Largest channel difference accepted against golden images.", "value", "1");
+    QCommandLineOption baselineOption("baseline", "CSV output of a previous run; fail when throughput drops below it.", "file");
+    QCommandLineOption marginOption("margin", "Fraction of baseline throughput that may be lost before failing.", "fraction", "0.15");
+    QCommandLineOption compareOption("compare", "Print MSE, PSNR and SSIM of the image pairs given as arguments instead of benchmarking.");
+    QCommandLineOption minimumSsimOption("min-ssim", "With --compare, fail when a pair's SSIM is below this.", "value", "0");
+    QCommandLineOption heatmapsOption("heatmaps", "With --compare, write a difference heatmap of every pair to a directory.", "directory");
+    parser.addOptions({sizesOption, threadsOption, opsOption, repeatOption, formatOption, outputOption,
+                       recordGoldenOption, checkGoldenOption, goldenSizeOption, goldenSourceOption, goldenReferenceOption, toleranceOption, baselineOption, marginOption,
+                       compareOption, minimumSsimOption, heatmapsOption});
+    parser.addPositionalArgument("pairs", "With --compare: reference and test images, alternating.", "[reference test...]");
+    parser.process(app);
+
+    if(parser.isSet(compareOption))
+        return comparePairs(parser.positionalArguments(), parser.value(heatmapsOption), parser.value(minimumSsimOption).toDouble()) == 0 ? 0 : 1;
+
+    QList<double> sizes;
+    for(auto size : parser.value(sizesOption).split(',', Qt::SkipEmptyParts))
+        sizes << size.toDouble();
+    auto threads = threadCounts(QThread::idealThreadCount());
+    if(parser.isSet(threadsOption)) {
+        threads.clear();
+        for(auto count : parser.value(threadsOption).split(',', Qt::SkipEmptyParts))
+            threads << std::max(1, count.toInt());
+    }
+    auto selected = parser.value(opsOption).split(',', Qt::SkipEmptyParts);
+    auto repetitions = std::max(1, parser.value(repeatOption).toInt());
+    auto json = parser.value(formatOption) == "json";
+
+    if(parser.isSet(recordGoldenOption) || parser.isSet(checkGoldenOption)) {
+        auto megapixels = parser.value(goldenSizeOption).toDouble();
+        auto record = parser.isSet(recordGoldenOption);
+        auto directory = parser.value(record ? recordGoldenOption : checkGoldenOption);
+        auto source = parser.isSet(goldenSourceOption) ? decodeImageUncached(parser.value(goldenSourceOption)) : syntheticImage(megapixels, 1);
+        if(source.isNull()) {
+            QTextStream(stderr) << "Could not open " << parser.value(goldenSourceOption) << "\n";
+            return 1;
+        }
+        auto reference = parser.isSet(goldenReferenceOption) ? decodeImageUncached(parser.value(goldenReferenceOption)) : syntheticImage(std::min(megapixels, 1.0), 2);
+        if(reference.isNull()) {
+            QTextStream(stderr) << "Could not open " << parser.value(goldenReferenceOption) << "\n";
+            return 1;
+        }
+        QList<BenchOperation> goldenOperations;
+        for(auto &operation : operations(reference))
+            if(selected.isEmpty() || selected.contains(operation.name))
+                goldenOperations << operation;
+        return checkGolden(goldenOperations, source, directory, record, parser.value(toleranceOption).toInt()) == 0 ? 0 : 1;
+    }
+
+    QFile file;
+    if(parser.isSet(outputOption)) {
+        file.setFileName(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QTextStream(stderr) << "Could not open " << file.fileName() << "\n";
+            return 1;
+        }
+    } else {
+        file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+    QTextStream out(&file);
+
+    QTextStream(stderr) << "kernels: " << kernels().name << " (cpu supports " << isaLevelName(supportedIsaLevel()) << ")\n";
+    QList<BenchResult> results;
+    for(auto megapixels : sizes) {
+        auto source = syntheticImage(megapixels, 1);
+        auto reference = syntheticImage(std::min(megapixels, 1.0), 2);
+        auto pixels = (double) source.width() * source.height();
+        for(auto &operation : operations(reference)) {
+            if(!selected.isEmpty() && !selected.contains(operation.name))
+                continue;
+            qint64 baseline = 0;
+            for(auto count : threads) {
+                QThreadPool::globalInstance()->setMaxThreadCount(count);
+                auto nanoseconds = measure(operation, source, repetitions);
+                if(baseline == 0)
+                    baseline = nanoseconds;
+                results << BenchResult{operation.name, pixels / 1e6, count, nanoseconds, nanoseconds / pixels, pixels / 1e6 / (nanoseconds / 1e9), baseline / (double) nanoseconds};
+                QTextStream(stderr) << operation.name << " " << megapixels << " MP x" << count << ": " << nanoseconds / 1e6 << " ms\n";
+            }
+        }
+    }
+
+    if(json) {
+        out << "[\n";
+        for(int i = 0; i < results.size(); i++) {
+            auto &result = results[i];
+            out << QString("  {\"operation\": \"%1\", \"megapixels\": %2, \"threads\": %3, \"ns\": %4, \"ns_per_pixel\": %5, \"mp_per_s\": %6, \"speedup\": %7}")
+                       .arg(result.operation).arg(result.megapixels).arg(result.threads).arg(result.nanoseconds)
+                       .arg(result.nsPerPixel).arg(result.megapixelsPerSecond).arg(result.speedup);
+            out << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "]\n";
+    } else {
+        out << "operation,megapixels,threads,ns,ns_per_pixel,mp_per_s,speedup\n";
+        for(auto &result : results)
+            out << QString("%1,%2,%3,%4,%5,%6,%7\n").arg(result.operation).arg(result.megapixels).arg(result.threads).arg(result.nanoseconds)
+                       .arg(result.nsPerPixel).arg(result.megapixelsPerSecond).arg(result.speedup);
+    }
+    out.flush();
+    if(parser.isSet(baselineOption))
+        return checkBaseline(results, parser.value(baselineOption), parser.value(marginOption).toDouble()) == 0 ? 0 : 1;
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "frame_sequence.h"
+#include "encoder.h"
+#include "io.h"
+#include "raw_image.h"
+#include "trace.h"
+
+#include <QCollator>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+
+static const char *const stageNames[SEQUENCE_STAGE_COUNT] = {"decode", "process", "encode"};
+
+const char *SequenceResult::slowestStage() const {
+    return stageNames[std::max_element(stageTime, stageTime + SEQUENCE_STAGE_COUNT) - stageTime];
+}
+
+QString SequenceResult::toString() const {
+    auto seconds = wallTime / 1e9;
+    return QString("%1 frames (%2 failed) in %3 s, %4 frames/s; decode %5 s, process %6 s, encode %7 s, limited by %8")
+        .arg(frames).arg(failures)
+        .arg(seconds, 0, 'f', 2)
+        .arg(seconds > 0 ? frames / seconds : 0.0, 0, 'f', 2)
+        .arg(stageTime[0] / 1e9, 0, 'f', 2)
+        .arg(stageTime[1] / 1e9, 0, 'f', 2)
+        .arg(stageTime[2] / 1e9, 0, 'f', 2)
+        .arg(slowestStage());
+}
+
+// The frame number in a pattern: a printf style %d or %0Nd, or a run of #
+// whose length is the width. Returns false for plain paths.
+static bool numberField(QString pattern, int &position, int &length, int &width) {
+    static const QRegularExpression field("%(0?\\d*)d|#+");
+    auto match = field.match(QFileInfo(pattern).fileName());
+    if(!match.hasMatch())
+        return false;
+    position = pattern.size() - QFileInfo(pattern).fileName().size() + match.capturedStart();
+    length = match.capturedLength();
+    width = match.captured(0).startsWith('#') ? length : match.captured(1).toInt();
+    return true;
+}
+
+static bool isImageFile(const QFileInfo &info) {
+    static const auto formats = QImageReader::supportedImageFormats();
+    auto suffix = info.suffix().toLower();
+    return suffix == RAW_IMAGE_SUFFIX || formats.contains(suffix.toLatin1());
+}
+
+QStringList sequenceFrames(QString input) {
+    QStringList result;
+    int position, length, width;
+    if(QFileInfo(input).isDir()) {
+        QDir dir(input);
+        for(auto &info : dir.entryInfoList(QDir::Files))
+            if(isImageFile(info))
+                result << info.filePath();
+        QCollator collator;
+        collator.setNumericMode(true);
+        std::sort(result.begin(), result.end(), [&collator](const QString &a, const QString &b) {
+            return collator.compare(a, b) < 0;
+        });
+        return result;
+    }
+    if(!numberField(input, position, length, width))
+        return QFileInfo(input).isFile() ? QStringList{input} : result;
+    QFileInfo info(input);
+    auto name = info.fileName();
+    auto offset = position - (input.size() - name.size());
+    QRegularExpression frame("^" + QRegularExpression::escape(name.left(offset)) + "(\\d+)"
+                             + QRegularExpression::escape(name.mid(offset + length)) + "$");
+    QList<QPair<qint64, QString>> numbered;
+    QDir dir = info.dir();
+    for(auto &entry : dir.entryList(QDir::Files)) {
+        auto match = frame.match(entry);
+        if(match.hasMatch())
+            numbered << qMakePair(match.captured(1).toLongLong(), dir.filePath(entry));
+    }
+    std::sort(numbered.begin(), numbered.end());
+    for(auto &entry : numbered)
+        result << entry.second;
+    return result;
+}
+
+QString sequenceOutputPath(QString output, QString inputPath, int index) {
+    int position, length, width;
+    if(!numberField(output, position, length, width))
+        return QDir(output).filePath(QFileInfo(inputPath).fileName());
+    return output.left(position) + QString("%1").arg(index, width, 10, QChar('0')) + output.mid(position + length);
+}
+
+// Single producer, single consumer queue between two stages. push() blocks
+// while capacity items are waiting and pop() while none are; once closed,
+// pop() drains what is left and then returns false.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(int capacity) : capacity(std::max(1, capacity)) {}
+
+    void push(T item) {
+        QMutexLocker locker(&mutex);
+        while((int) items.size() >= capacity)
+            notFull.wait(&mutex);
+        items.push_back(std::move(item));
+        notEmpty.wakeOne();
+    }
+
+    bool pop(T &item) {
+        QMutexLocker locker(&mutex);
+        while(items.empty() && !closed)
+            notEmpty.wait(&mutex);
+        if(items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.wakeOne();
+        return true;
+    }
+
+    void close() {
+        QMutexLocker locker(&mutex);
+        closed = true;
+        notEmpty.wakeAll();
+    }
+
+private:
+    int capacity;
+    bool closed = false;
+    std::deque<T> items;
+    QMutex mutex;
+    QWaitCondition notFull, notEmpty;
+};
+
+struct SequenceFrame {
+    int index;
+    QString path;
+    QImage image;
+};
+
+SequenceResult processSequence(QStringList frames, QString output, std::function<QImage(QImage)> process,
+                               int quality, int queueDepth, std::function<void(int)> progress) {
+    SequenceResult result;
+    if(frames.isEmpty())
+        return result;
+    QDir().mkpath(QFileInfo(sequenceOutputPath(output, frames[0], 0)).absolutePath());
+    QElapsedTimer wall;
+    wall.start();
+    BoundedQueue<SequenceFrame> decoded(queueDepth), processed(queueDepth);
+    std::atomic<int> failures{0};
+
+    // Decoding and encoding are mostly single threaded, so each gets a
+    // thread of its own rather than a slot in the global pool, which the
+    // process stage keeps for its row bands.
+    auto decoder = QThread::create([&] {
+        for(int i = 0; i < frames.size(); i++) {
+            QElapsedTimer timer;
+            timer.start();
+            QImage image;
+            {
+                TraceScope scope("decodeFrame", "decode");
+                image = decodeImageUncached(frames[i]);
+            }
+            result.stageTime[0] += timer.nsecsElapsed();
+            if(image.isNull()) {
+                failures++;
+                continue;
+            }
+            decoded.push(SequenceFrame{i, frames[i], image});
+        }
+        decoded.close();
+    });
+    auto written = 0;
+    auto encoder = QThread::create([&] {
+        SequenceFrame frame;
+        while(processed.pop(frame)) {
+            QElapsedTimer timer;
+            timer.start();
+            auto target = sequenceOutputPath(output, frame.path, frame.index);
+            // An output directory equal to the input's must not replace the
+            // originals.
+            auto saved = false;
+            if(QFileInfo(target).canonicalFilePath() != QFileInfo(frame.path).canonicalFilePath()) {
+                TraceScope scope("encodeFrame", "encode");
+                saved = ImageEncoder::encode(frame.image, target, ImageEncoder::settingsFor(target, quality));
+            }
+            frame.image = QImage();
+            result.stageTime[2] += timer.nsecsElapsed();
+            if(!saved)
+                failures++;
+            if(progress)
+                progress(++written);
+        }
+    });
+    decoder->start();
+    encoder->start();
+
+    SequenceFrame frame;
+    while(decoded.pop(frame)) {
+        QElapsedTimer timer;
+        timer.start();
+        {
+            OperationTrace trace("processFrame", (qint64) frame.image.width() * frame.image.height());
+            frame.image = process(frame.image);
+        }
+        result.stageTime[1] += timer.nsecsElapsed();
+        processed.push(std::move(frame));
+    }
+    processed.close();
+
+    decoder->wait();
+    encoder->wait();
+    delete decoder;
+    delete encoder;
+    result.frames = frames.size();
+    result.failures = failures;
+    result.wallTime = wall.nsecsElapsed();
+    return result;
+}
@@ -0,0 +1,49 @@
+#ifndef FRAME_SEQUENCE_H
+#define FRAME_SEQUENCE_H
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+
+#define SEQUENCE_DEFAULT_QUEUE_DEPTH 2
+#define SEQUENCE_STAGE_COUNT 3
+
+// Frames of a sequence in order. input is either a directory, whose image
+// files are taken in natural order (frame2 before frame10), or a numbered
+// pattern such as scan_%04d.tif or scan_####.tif, matched against the files
+// of its directory and ordered by number.
+QStringList sequenceFrames(QString input);
+
+// Where frame index of the sequence, read from inputPath, is written.
+// output is a numbered pattern as above, filled with index, or a directory
+// that receives the frame under its input name.
+QString sequenceOutputPath(QString output, QString inputPath, int index);
+
+struct SequenceResult {
+    int frames = 0;
+    int failures = 0;
+    qint64 wallTime = 0;
+    // Time every stage (decode, process, encode) spent working, not waiting
+    // on its queues. With the stages overlapped, wallTime approaches the
+    // largest of these rather than their sum.
+    qint64 stageTime[SEQUENCE_STAGE_COUNT] = {};
+
+    const char *slowestStage() const;
+    QString toString() const;
+};
+
+// Decodes, processes and encodes the frames as three pipelined stages
+// connected by queues holding at most queueDepth frames. Decoding and
+// encoding run on threads of their own and overlap processing, which runs on
+// the calling thread and still spreads each frame over the global pool. No
+// more than 2 * queueDepth + 3 frames are in memory at once. Frames that fail
+// to decode or encode, or whose output would replace the input, are counted
+// and skipped. progress, when set, is called from the encode thread after
+// every frame.
+SequenceResult processSequence(QStringList frames, QString output, std::function<QImage(QImage)> process,
+                               int quality = -1, int queueDepth = SEQUENCE_DEFAULT_QUEUE_DEPTH,
+                               std::function<void(int)> progress = nullptr);
+
+#endif // FRAME_SEQUENCE_H
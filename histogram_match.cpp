@@ -0,0 +1,152 @@
+#include "histogram_match.h"
+#include "io.h"
+#include "parallel.h"
+#include "planar_image.h"
+#include "trace.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QtConcurrent/QtConcurrent>
+
+void ChannelHistograms::add(const ChannelHistograms &other) {
+    for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++)
+        for(int i = 0; i < 256; i++)
+            counts[channel][i] += other.counts[channel][i];
+    total += other.total;
+}
+
+ChannelHistograms ChannelHistograms::pooled() const {
+    ChannelHistograms result;
+    for(int i = 0; i < 256; i++) {
+        quint64 sum = 0;
+        for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++)
+            sum += counts[channel][i];
+        for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++)
+            result.counts[channel][i] = sum;
+    }
+    result.total = total * DEFAULT_CHANNEL_COUNT;
+    return result;
+}
+
+ChannelHistograms channelHistograms(const QImage &source) {
+    if(source.format() == QImage::Format_Grayscale8) {
+        ChannelHistograms result;
+        QMutex mutex;
+        parallelRows(source.height(), [&](int begin, int end) {
+            quint64 partial[256] = {};
+            for(int y = begin; y < end; y++) {
+                auto gray = source.constScanLine(y);
+                for(int x = 0; x < source.width(); x++)
+                    partial[gray[x]]++;
+            }
+            QMutexLocker locker(&mutex);
+            for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++)
+                for(int i = 0; i < 256; i++)
+                    result.counts[channel][i] += partial[i];
+            result.total += (quint64) (end - begin) * source.width();
+        });
+        return result;
+    }
+    auto image = source.depth() == 32 ? source : source.convertToFormat(QImage::Format_RGB32);
+    ChannelHistograms result;
+    QMutex mutex;
+    parallelRows(image.height(), [&](int begin, int end) {
+        ChannelHistograms partial;
+        for(int y = begin; y < end; y++) {
+            auto pixels = (const QRgb*) image.constScanLine(y);
+            for(int x = 0; x < image.width(); x++) {
+                partial.counts[0][qRed(pixels[x])]++;
+                partial.counts[1][qGreen(pixels[x])]++;
+                partial.counts[2][qBlue(pixels[x])]++;
+            }
+        }
+        partial.total = (quint64) (end - begin) * image.width();
+        QMutexLocker locker(&mutex);
+        result.add(partial);
+    });
+    return result;
+}
+
+ChannelLookup histogramMapping(const ChannelHistograms &source, const ChannelHistograms &reference) {
+    ChannelLookup mapping;
+    for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++) {
+        if(source.total == 0 || reference.total == 0) {
+            for(int i = 0; i < 256; i++)
+                mapping.table[channel][i] = i;
+            continue;
+        }
+        // Both CDFs are non-decreasing, so the matching reference level never
+        // moves backwards and a single pass over each histogram suffices.
+        quint64 sourceSum = 0, referenceSum = reference.counts[channel][0];
+        int level = 0;
+        for(int i = 0; i < 256; i++) {
+            sourceSum += source.counts[channel][i];
+            auto target = (double) sourceSum / source.total;
+            while(level < 255 && (double) referenceSum / reference.total < target)
+                referenceSum += reference.counts[channel][++level];
+            mapping.table[channel][i] = level;
+        }
+    }
+    return mapping;
+}
+
+ReferenceHistogramCache &ReferenceHistogramCache::instance() {
+    static ReferenceHistogramCache cache;
+    return cache;
+}
+
+bool ReferenceHistogramCache::histograms(QString path, ChannelHistograms &result) {
+    QFileInfo info(path);
+    if(!info.exists())
+        return false;
+    auto key = info.absoluteFilePath();
+    {
+        QMutexLocker locker(&mutex);
+        auto entry = entries.constFind(key);
+        if(entry != entries.constEnd() && entry->modified == info.lastModified() && entry->size == info.size()) {
+            result = entry->histograms;
+            return true;
+        }
+    }
+    auto image = decodeImage(path);
+    if(image.isNull())
+        return false;
+    Entry entry;
+    entry.modified = info.lastModified();
+    entry.size = info.size();
+    entry.histograms = channelHistograms(image);
+    QMutexLocker locker(&mutex);
+    entries.insert(key, entry);
+    result = entry.histograms;
+    return true;
+}
+
+void ReferenceHistogramCache::clear() {
+    QMutexLocker locker(&mutex);
+    entries.clear();
+}
+
+QFuture<bool> matchHistogramBatch(QStringList files, QString referencePath, QString outputDirectory, int quality) {
+    ChannelHistograms reference;
+    if(!ReferenceHistogramCache::instance().histograms(referencePath, reference))
+        return QtConcurrent::mapped(files, [](const QString &) {
+            return false;
+        });
+    QDir().mkpath(outputDirectory);
+    return QtConcurrent::mapped(files, [reference, outputDirectory, quality](const QString &path) {
+        auto target = QDir(outputDirectory).filePath(QFileInfo(path).fileName());
+        // Never overwrite an original, as happens when the output directory
+        // is the input's.
+        if(QFileInfo(target).canonicalFilePath() == QFileInfo(path).canonicalFilePath())
+            return false;
+        auto image = decodeImageUncached(path);
+        if(image.isNull())
+            return false;
+        OperationTrace trace("matchHistogramBatch", (qint64) image.width() * image.height());
+        auto gray = image.format() == QImage::Format_Grayscale8;
+        if(!gray && image.depth() != 32)
+            image = image.convertToFormat(QImage::Format_RGB32);
+        applyLookup(image, image.rect(), histogramMapping(channelHistograms(image), gray ? reference.pooled() : reference));
+        return ImageEncoder::encode(image, target, ImageEncoder::settingsFor(target, quality));
+    });
+}
@@ -0,0 +1,57 @@
+#ifndef HISTOGRAM_MATCH_H
+#define HISTOGRAM_MATCH_H
+
+#include "definitions.h"
+#include "encoder.h"
+#include "kernels.h"
+
+#include <QDateTime>
+#include <QFuture>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QStringList>
+
+struct ChannelHistograms {
+    quint64 counts[DEFAULT_CHANNEL_COUNT][256] = {};
+    quint64 total = 0;
+
+    void add(const ChannelHistograms &other);
+    // Every channel replaced by the sum of all three, the reference a
+    // single-channel image is matched against.
+    ChannelHistograms pooled() const;
+};
+
+// Format_Grayscale8 images count their one channel into all three.
+ChannelHistograms channelHistograms(const QImage &image);
+// Takes each source level to the reference level with the nearest
+// cumulative frequency, channel by channel.
+ChannelLookup histogramMapping(const ChannelHistograms &source, const ChannelHistograms &reference);
+
+// Reference histograms keyed by path, modification time and size, so
+// matching many images to the same reference decodes it only once.
+class ReferenceHistogramCache {
+public:
+    static ReferenceHistogramCache &instance();
+
+    bool histograms(QString path, ChannelHistograms &result);
+    void clear();
+
+private:
+    struct Entry {
+        QDateTime modified;
+        qint64 size;
+        ChannelHistograms histograms;
+    };
+
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+};
+
+// Matches every file in the list to the reference and writes the result
+// under the same name into the output directory. Files are processed in
+// parallel; each result reports whether that file was written. Files whose
+// output would replace the input itself are skipped and report false.
+QFuture<bool> matchHistogramBatch(QStringList files, QString referencePath, QString outputDirectory, int quality = -1);
+
+#endif // HISTOGRAM_MATCH_H
@@ -0,0 +1,50 @@
+#include "histogram_view.h"
+
+#include <QGridLayout>
+#include <QWidget>
+#include <QtCharts/QBarSet>
+#include <QtCharts/QChart>
+#include <QtCharts/QChartView>
+#include <QtCharts/QStackedBarSeries>
+#include <QtCharts/QValueAxis>
+
+#include <algorithm>
+
+void showHistogramWindow(QString title, const ChannelStatistics &statistics) {
+    auto counts = statistics.counts;
+    auto [min, max] = std::minmax_element(counts, counts + 256);
+    const int pixelSize = 256;
+    QBarSet *sets[pixelSize] = {};
+    QStringList categories;
+    for(int i = 0; i < pixelSize; i++) {
+        categories << QString::number(i);
+        sets[i] = new QBarSet(QString::number(i));
+        QList list = QList<qreal>(256, 0);
+        list.insert(i, counts[i]);
+        sets[i]->append(list);
+    }
+    QWidget *window = new QWidget;
+    QGridLayout *layout = new QGridLayout;
+    window->setLayout(layout);
+    QChart *chart = new QChart();
+    chart->setTitle(title + "\n" + statistics.toString());
+    chart->setAnimationOptions(QChart::SeriesAnimations);
+    QStackedBarSeries *series = new QStackedBarSeries();
+    chart->addSeries(series);
+    for(int i = 0; i < pixelSize; i++)
+        series->append(sets[i]);
+    QValueAxis *axisX = new QValueAxis();
+    axisX->setRange(0, pixelSize - 1);
+    chart->addAxis(axisX, Qt::AlignBottom);
+    series->attachAxis(axisX);
+    QValueAxis *axisY = new QValueAxis();
+    axisY->setRange(*min, *max);
+    chart->addAxis(axisY, Qt::AlignLeft);
+    series->attachAxis(axisY);
+    QChartView *chartView = new QChartView(chart);
+    chartView->setRenderHint(QPainter::Antialiasing);
+    chart->legend()->setVisible(false);
+    layout->addWidget(chartView, 0, 0);
+    window->setMinimumSize(720, 480);
+    window->show();
+}
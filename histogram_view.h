@@ -0,0 +1,14 @@
+#ifndef HISTOGRAM_VIEW_H
+#define HISTOGRAM_VIEW_H
+
+#include "image_statistics.h"
+
+#include <QString>
+
+// Opens a window with a bar chart of the channel's 256 counts and its
+// summary statistics under the title. This is the only code that uses Qt
+// Charts, and only the GUI target builds it, so no chart object exists
+// until the first histogram is shown.
+void showHistogramWindow(QString title, const ChannelStatistics &statistics);
+
+#endif // HISTOGRAM_VIEW_H
@@ -0,0 +1,117 @@
+#include "image_cache.h"
+#include "io.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QtConcurrent/QtConcurrent>
+
+QString ImageCacheStatistics::toString() const {
+    return QString("image cache %1 hits, %2 misses, %3 MB")
+        .arg(hits)
+        .arg(misses)
+        .arg(cachedBytes / (1024.0 * 1024.0), 0, 'f', 0);
+}
+
+ImageCache::ImageCache() {
+    bool ok = false;
+    auto megabytes = qEnvironmentVariableIntValue("FPI_IMAGE_CACHE_MB", &ok);
+    setCapacity(ok && megabytes >= 0 ? (qint64) megabytes * 1024 * 1024 : DEFAULT_IMAGE_CACHE_CAPACITY);
+}
+
+ImageCache &ImageCache::instance() {
+    static ImageCache cache;
+    return cache;
+}
+
+QString ImageCache::key(QString path, int scaleDenominator) {
+    QFileInfo info(path);
+    if(!info.exists())
+        return QString();
+    return QString("%1|%2|%3|%4").arg(info.absoluteFilePath()).arg(info.lastModified().toMSecsSinceEpoch()).arg(info.size()).arg(scaleDenominator);
+}
+
+QImage ImageCache::lookup(const QString &key) {
+    if(auto image = images.object(key)) {
+        counters.hits++;
+        return *image;
+    }
+    return QImage();
+}
+
+void ImageCache::insert(const QString &key, const QImage &image) {
+    pending.remove(key);
+    if(image.isNull())
+        return;
+    // Costs are in kilobytes so large caps fit QCache's int cost.
+    images.insert(key, new QImage(image), std::max<qint64>(1, image.sizeInBytes() / 1024));
+    counters.cachedBytes = (qint64) images.totalCost() * 1024;
+}
+
+QImage ImageCache::decode(QString path, int scaleDenominator) {
+    auto cacheKey = key(path, scaleDenominator);
+    if(cacheKey.isEmpty())
+        return decodeImageUncached(path, scaleDenominator);
+    QFuture<QImage> inFlight;
+    {
+        QMutexLocker locker(&mutex);
+        auto cached = lookup(cacheKey);
+        if(!cached.isNull())
+            return cached;
+        if(pending.contains(cacheKey)) {
+            counters.hits++;
+            inFlight = pending.value(cacheKey);
+        } else {
+            counters.misses++;
+        }
+    }
+    if(inFlight.isValid())
+        return inFlight.result();
+    auto image = decodeImageUncached(path, scaleDenominator);
+    QMutexLocker locker(&mutex);
+    insert(cacheKey, image);
+    return image;
+}
+
+QFuture<QImage> ImageCache::decodeAsync(QString path, int scaleDenominator) {
+    auto cacheKey = key(path, scaleDenominator);
+    if(cacheKey.isEmpty())
+        return QtConcurrent::run(decodeImageUncached, path, scaleDenominator);
+    QMutexLocker locker(&mutex);
+    auto cached = lookup(cacheKey);
+    if(!cached.isNull())
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+        return QtFuture::makeReadyValueFuture(cached);
+#else
+        return QtFuture::makeReadyFuture(cached);
+#endif
+    if(pending.contains(cacheKey)) {
+        counters.hits++;
+        return pending.value(cacheKey);
+    }
+    counters.misses++;
+    auto future = QtConcurrent::run([this, path, scaleDenominator, cacheKey]() {
+        auto image = decodeImageUncached(path, scaleDenominator);
+        QMutexLocker locker(&mutex);
+        insert(cacheKey, image);
+        return image;
+    });
+    pending.insert(cacheKey, future);
+    return future;
+}
+
+ImageCacheStatistics ImageCache::statistics() {
+    QMutexLocker locker(&mutex);
+    return counters;
+}
+
+void ImageCache::setCapacity(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    images.setMaxCost((int) std::min<qint64>(INT_MAX, bytes / 1024));
+    counters.cachedBytes = (qint64) images.totalCost() * 1024;
+}
+
+void ImageCache::clear() {
+    QMutexLocker locker(&mutex);
+    images.clear();
+    counters.cachedBytes = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <QCache>
+#include <QFuture>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+
+#define DEFAULT_IMAGE_CACHE_CAPACITY (512LL * 1024 * 1024)
+
+struct ImageCacheStatistics {
+    quint64 hits = 0, misses = 0;
+    qint64 cachedBytes = 0;
+
+    QString toString() const;
+};
+
+// Process-wide LRU cache of decoded images keyed by absolute path,
+// modification time, file size and scale. Entries are implicitly shared
+// QImages, so every caller gets the same pixels and the first write
+// detaches a private copy. A decode already in flight is shared too, so
+// two windows opening the same file decode it once. FPI_IMAGE_CACHE_MB
+// overrides the default capacity.
+class ImageCache {
+public:
+    static ImageCache &instance();
+
+    QImage decode(QString path, int scaleDenominator);
+    QFuture<QImage> decodeAsync(QString path, int scaleDenominator);
+
+    ImageCacheStatistics statistics();
+    void setCapacity(qint64 bytes);
+    void clear();
+
+private:
+    QMutex mutex;
+    QCache<QString, QImage> images;
+    QHash<QString, QFuture<QImage>> pending;
+    ImageCacheStatistics counters;
+
+    ImageCache();
+
+    static QString key(QString path, int scaleDenominator);
+    QImage lookup(const QString &key);
+    void insert(const QString &key, const QImage &image);
+};
+
+#endif // IMAGE_CACHE_H
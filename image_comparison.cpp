@@ -0,0 +1,170 @@
+#include "image_comparison.h"
+#include "buffer_pool.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "planar_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Wang et al.'s stabilising constants for 8-bit samples.
+#define SSIM_C1 ((0.01 * 255) * (0.01 * 255))
+#define SSIM_C2 ((0.03 * 255) * (0.03 * 255))
+
+double ImageComparison::mse() const {
+    if(channels == 0)
+        return 0;
+    double sum = 0;
+    for(int i = 0; i < channels; i++)
+        sum += channelMse[i];
+    return sum / channels;
+}
+
+double ImageComparison::psnr() const {
+    auto error = mse();
+    if(error == 0)
+        return std::numeric_limits<double>::infinity();
+    return 10 * std::log10(255.0 * 255.0 / error);
+}
+
+double ImageComparison::ssim() const {
+    if(channels == 0)
+        return 0;
+    double sum = 0;
+    for(int i = 0; i < channels; i++)
+        sum += channelSsim[i];
+    return sum / channels;
+}
+
+QString ImageComparison::toString() const {
+    if(channels == 0)
+        return "Images differ in size";
+    return QString("MSE %1, PSNR %2 dB, SSIM %3")
+        .arg(mse(), 0, 'f', 3)
+        .arg(psnr(), 0, 'f', 2)
+        .arg(ssim(), 0, 'f', 4);
+}
+
+// Both images as planes with the same channel count: grayscale only when
+// both are.
+static bool comparablePlanes(const QImage &reference, const QImage &test, PlanarImage &first, PlanarImage &second) {
+    if(reference.isNull() || reference.size() != test.size())
+        return false;
+    auto gray = reference.format() == QImage::Format_Grayscale8 && test.format() == QImage::Format_Grayscale8;
+    first = PlanarImage::fromImage(gray ? reference : reference.convertToFormat(QImage::Format_RGB32));
+    second = PlanarImage::fromImage(gray ? test : test.convertToFormat(QImage::Format_RGB32));
+    return true;
+}
+
+struct SquaredErrors {
+    quint64 sum[DEFAULT_CHANNEL_COUNT] = {};
+};
+
+static void squaredErrors(const PlanarImage &first, const PlanarImage &second, double *mse) {
+    auto squaredErrorRow = kernels().squaredErrorRow;
+    SquaredErrors identity;
+    auto result = parallelReduce(first.height(), identity, [&](SquaredErrors &partial, int begin, int end) {
+        for(int channel = 0; channel < first.channels(); channel++)
+            for(int y = begin; y < end; y++)
+                partial.sum[channel] += squaredErrorRow(first.row(channel, y), second.row(channel, y), first.width());
+    }, [](SquaredErrors &result, const SquaredErrors &partial) {
+        for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++)
+            result.sum[channel] += partial.sum[channel];
+    });
+    auto samples = (double) first.width() * first.height();
+    for(int channel = 0; channel < first.channels(); channel++)
+        mse[channel] = result.sum[channel] / samples;
+}
+
+struct SsimSums {
+    double sum[DEFAULT_CHANNEL_COUNT] = {};
+};
+
+// Sum of SSIM over the window * window squares whose top row is in
+// [begin, end). Column sums of x, y, x^2, y^2 and xy slide down one row at a
+// time; ssimRow adds them across and scores the whole row of windows.
+static void ssimRows(const PlanarImage &first, const PlanarImage &second, int channel, int window, int begin, int end, double &sum) {
+    auto ssimColumnsRow = kernels().ssimColumnsRow;
+    auto ssimRow = kernels().ssimRow;
+    auto width = first.width();
+    std::vector<quint32> columns((size_t) width * 5);
+    std::vector<float> scores(width - window + 1);
+    for(int y = begin; y < begin + window; y++)
+        ssimColumnsRow(first.row(channel, y), second.row(channel, y), columns.data(), width, width, false);
+    for(int top = begin; top < end; top++) {
+        if(top > begin) {
+            ssimColumnsRow(first.row(channel, top - 1), second.row(channel, top - 1), columns.data(), width, width, true);
+            ssimColumnsRow(first.row(channel, top + window - 1), second.row(channel, top + window - 1), columns.data(), width, width, false);
+        }
+        ssimRow(columns.data(), width, scores.data(), (int) scores.size(), window, (float) SSIM_C1, (float) SSIM_C2);
+        for(auto score : scores)
+            sum += score;
+    }
+}
+
+static void structuralSimilarity(const PlanarImage &first, const PlanarImage &second, double *ssim) {
+    auto window = std::min({SSIM_WINDOW, first.width(), first.height()});
+    auto tops = first.height() - window + 1;
+    SsimSums identity;
+    auto result = parallelReduce(tops, identity, [&](SsimSums &partial, int begin, int end) {
+        for(int channel = 0; channel < first.channels(); channel++)
+            ssimRows(first, second, channel, window, begin, end, partial.sum[channel]);
+    }, [](SsimSums &result, const SsimSums &partial) {
+        for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++)
+            result.sum[channel] += partial.sum[channel];
+    });
+    auto windows = (double) tops * (first.width() - window + 1);
+    for(int channel = 0; channel < first.channels(); channel++)
+        ssim[channel] = result.sum[channel] / windows;
+}
+
+ImageComparison compareImages(const QImage &reference, const QImage &test) {
+    ImageComparison result;
+    PlanarImage first, second;
+    if(!comparablePlanes(reference, test, first, second))
+        return result;
+    result.channels = first.channels();
+    squaredErrors(first, second, result.channelMse);
+    structuralSimilarity(first, second, result.channelSsim);
+    return result;
+}
+
+// Black through red and yellow to white.
+static QRgb heatColour(int level) {
+    auto channel = [level](int offset) {
+        return std::clamp(3 * level - offset, 0, 255);
+    };
+    return qRgb(channel(0), channel(255), channel(510));
+}
+
+QImage differenceHeatmap(const QImage &reference, const QImage &test, int gain) {
+    PlanarImage first, second;
+    if(!comparablePlanes(reference, test, first, second))
+        return QImage();
+    QRgb palette[256];
+    for(int difference = 0; difference < 256; difference++)
+        palette[difference] = heatColour(std::min(255, difference * std::max(1, gain)));
+    auto result = BufferPool::instance().image(first.width(), first.height(), QImage::Format_RGB32);
+    auto pixels = result.bits();
+    auto stride = result.bytesPerLine();
+    parallelRows(first.height(), [&](int begin, int end) {
+        std::vector<BYTE> largest(first.width());
+        for(int y = begin; y < end; y++) {
+            std::fill(largest.begin(), largest.end(), 0);
+            for(int channel = 0; channel < first.channels(); channel++) {
+                auto a = first.row(channel, y);
+                auto b = second.row(channel, y);
+                for(int x = 0; x < first.width(); x++) {
+                    BYTE difference = a[x] > b[x] ? a[x] - b[x] : b[x] - a[x];
+                    largest[x] = std::max(largest[x], difference);
+                }
+            }
+            auto out = (QRgb*) (pixels + y * stride);
+            for(int x = 0; x < first.width(); x++)
+                out[x] = palette[largest[x]];
+        }
+    });
+    return result;
+}
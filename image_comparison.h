@@ -0,0 +1,47 @@
+#ifndef IMAGE_COMPARISON_H
+#define IMAGE_COMPARISON_H
+
+#include "definitions.h"
+
+#include <QImage>
+#include <QString>
+
+#define SSIM_WINDOW 7
+#define HEATMAP_DEFAULT_GAIN 8
+
+// Per-channel difference between a reference image and a test image of the
+// same size. SSIM is Wang et al.'s index over every SSIM_WINDOW square
+// window, averaged over the windows.
+struct ImageComparison {
+    // 1 when both images are Format_Grayscale8, DEFAULT_CHANNEL_COUNT
+    // otherwise, 0 when their sizes differ.
+    int channels = 0;
+    double channelMse[DEFAULT_CHANNEL_COUNT] = {};
+    double channelSsim[DEFAULT_CHANNEL_COUNT] = {};
+
+    bool isValid() const {
+        return channels > 0;
+    }
+
+    // Averages over the channels. psnr() is in dB and infinite for
+    // identical images.
+    double mse() const;
+    double psnr() const;
+    double ssim() const;
+
+    QString toString() const;
+};
+
+// MSE, PSNR and SSIM in parallel passes over the rows. SSIM's column sums
+// slide down the rows in integers, two row updates per step whatever the
+// window; across the row, each window adds SSIM_WINDOW column sums, a cost
+// kept vectorizable (see ssimRow) rather than made independent of the
+// window by a serial running sum.
+ImageComparison compareImages(const QImage &reference, const QImage &test);
+
+// RGB32 map of the largest channel difference at every pixel, multiplied by
+// gain and drawn black through red and yellow to white. Null when the sizes
+// differ.
+QImage differenceHeatmap(const QImage &reference, const QImage &test, int gain = HEATMAP_DEFAULT_GAIN);
+
+#endif // IMAGE_COMPARISON_H
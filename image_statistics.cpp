@@ -0,0 +1,132 @@
+#include "image_statistics.h"
+#include "kernels.h"
+#include "parallel.h"
+
+#include <QStringList>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+void ChannelStatistics::add(const ChannelStatistics &other) {
+    for(int i = 0; i < 256; i++)
+        counts[i] += other.counts[i];
+    total += other.total;
+}
+
+int ChannelStatistics::minimum() const {
+    for(int i = 0; i < 256; i++)
+        if(counts[i] != 0)
+            return i;
+    return 0;
+}
+
+int ChannelStatistics::maximum() const {
+    for(int i = 255; i >= 0; i--)
+        if(counts[i] != 0)
+            return i;
+    return 0;
+}
+
+double ChannelStatistics::mean() const {
+    if(total == 0)
+        return 0;
+    quint64 sum = 0;
+    for(int i = 0; i < 256; i++)
+        sum += counts[i] * i;
+    return (double) sum / total;
+}
+
+double ChannelStatistics::standardDeviation() const {
+    if(total == 0)
+        return 0;
+    auto average = mean();
+    double sum = 0;
+    for(int i = 0; i < 256; i++)
+        sum += counts[i] * (i - average) * (i - average);
+    return std::sqrt(sum / total);
+}
+
+int ChannelStatistics::percentile(double fraction) const {
+    if(total == 0)
+        return 0;
+    auto rank = std::max<quint64>(1, (quint64) std::ceil(std::clamp(fraction, 0.0, 1.0) * total));
+    quint64 sum = 0;
+    for(int i = 0; i < 256; i++) {
+        sum += counts[i];
+        if(sum >= rank)
+            return i;
+    }
+    return 255;
+}
+
+QString ChannelStatistics::toString() const {
+    return QString("min %1, max %2, mean %3, stddev %4, p5 %5, median %6, p95 %7")
+        .arg(minimum())
+        .arg(maximum())
+        .arg(mean(), 0, 'f', 1)
+        .arg(standardDeviation(), 0, 'f', 1)
+        .arg(percentile(0.05))
+        .arg(percentile(0.5))
+        .arg(percentile(0.95));
+}
+
+void ImageStatistics::add(const ImageStatistics &other) {
+    channels = std::max(channels, other.channels);
+    for(int channel = 0; channel < DEFAULT_CHANNEL_COUNT; channel++)
+        this->channel[channel].add(other.channel[channel]);
+    luminance.add(other.luminance);
+}
+
+QString ImageStatistics::toString() const {
+    if(channels == 1)
+        return "Gray: " + channel[0].toString();
+    QStringList lines;
+    const char *names[DEFAULT_CHANNEL_COUNT] = {"Red", "Green", "Blue"};
+    for(int i = 0; i < channels; i++)
+        lines << QString(names[i]) + ": " + channel[i].toString();
+    lines << "Luminance: " + luminance.toString();
+    return lines.join('\n');
+}
+
+ImageStatistics imageStatistics(const QImage &source, QRect rect) {
+    auto gray = source.format() == QImage::Format_Grayscale8;
+    auto image = gray || source.depth() == 32 ? source : source.convertToFormat(QImage::Format_RGB32);
+    rect = rect.intersected(image.rect());
+    ImageStatistics identity;
+    identity.channels = gray ? 1 : DEFAULT_CHANNEL_COUNT;
+    if(rect.isEmpty())
+        return identity;
+    auto grayscaleRow = kernels().grayscaleRow;
+    auto result = parallelReduce(rect.height(), identity, [&](ImageStatistics &partial, int begin, int end) {
+        auto samples = (quint64) (end - begin) * rect.width();
+        if(gray) {
+            for(int y = rect.top() + begin; y < rect.top() + end; y++) {
+                auto pixels = image.constScanLine(y) + rect.left();
+                for(int x = 0; x < rect.width(); x++)
+                    partial.channel[0].counts[pixels[x]]++;
+            }
+            partial.channel[0].total += samples;
+            return;
+        }
+        std::vector<BYTE> luminance(rect.width());
+        for(int y = rect.top() + begin; y < rect.top() + end; y++) {
+            auto pixels = (const QRgb*) image.constScanLine(y) + rect.left();
+            grayscaleRow(pixels, luminance.data(), rect.width());
+            for(int x = 0; x < rect.width(); x++) {
+                partial.channel[0].counts[qRed(pixels[x])]++;
+                partial.channel[1].counts[qGreen(pixels[x])]++;
+                partial.channel[2].counts[qBlue(pixels[x])]++;
+                partial.luminance.counts[luminance[x]]++;
+            }
+        }
+        for(auto &channel : partial.channel)
+            channel.total += samples;
+        partial.luminance.total += samples;
+    }, [](ImageStatistics &result, const ImageStatistics &partial) {
+        result.add(partial);
+    });
+    if(gray)
+        result.luminance = result.channel[0];
+    return result;
+}
@@ -0,0 +1,44 @@
+#ifndef IMAGE_STATISTICS_H
+#define IMAGE_STATISTICS_H
+
+#include "definitions.h"
+
+#include <QImage>
+#include <QRect>
+#include <QString>
+
+// Histogram of one 8-bit channel. Every statistic is derived from the 256
+// counts, so they are exact and partial results merge by adding counts.
+struct ChannelStatistics {
+    quint64 counts[256] = {};
+    quint64 total = 0;
+
+    void add(const ChannelStatistics &other);
+
+    int minimum() const;
+    int maximum() const;
+    double mean() const;
+    double standardDeviation() const;
+    // Nearest-rank percentile: the lowest level with at least the given
+    // fraction of the samples at or below it.
+    int percentile(double fraction) const;
+
+    QString toString() const;
+};
+
+struct ImageStatistics {
+    // 1 for Format_Grayscale8, DEFAULT_CHANNEL_COUNT (red, green, blue)
+    // otherwise.
+    int channels = 0;
+    ChannelStatistics channel[DEFAULT_CHANNEL_COUNT];
+    ChannelStatistics luminance;
+
+    void add(const ImageStatistics &other);
+    QString toString() const;
+};
+
+// Per-channel and luminance statistics of the rectangle in a single
+// parallel pass over its rows.
+ImageStatistics imageStatistics(const QImage &image, QRect rect);
+
+#endif // IMAGE_STATISTICS_H
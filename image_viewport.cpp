@@ -0,0 +1,397 @@
+#include "image_viewport.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <QGuiApplication>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QScreen>
+#include <QScrollBar>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static void downsampleRegion(const QImage &source, QImage &target, QRect rect) {
+    auto lastColumn = source.width() - 1;
+    auto lastRow = source.height() - 1;
+    // Detached once here rather than by scanLine() in every worker.
+    auto pixels = target.bits();
+    auto stride = target.bytesPerLine();
+    if(source.depth() == 8) {
+        parallelRows(rect.height(), [&](int begin, int end) {
+            for(int y = rect.top() + begin; y < rect.top() + end; y++) {
+                auto first = source.constScanLine(std::min(2 * y, lastRow));
+                auto second = source.constScanLine(std::min(2 * y + 1, lastRow));
+                auto out = pixels + y * stride;
+                for(int x = rect.left(); x <= rect.right(); x++) {
+                    auto left = std::min(2 * x, lastColumn);
+                    auto right = std::min(2 * x + 1, lastColumn);
+                    out[x] = (first[left] + first[right] + second[left] + second[right] + 2) / 4;
+                }
+            }
+        });
+        return;
+    }
+    parallelRows(rect.height(), [&](int begin, int end) {
+        for(int y = rect.top() + begin; y < rect.top() + end; y++) {
+            auto first = (const QRgb*) source.constScanLine(std::min(2 * y, lastRow));
+            auto second = (const QRgb*) source.constScanLine(std::min(2 * y + 1, lastRow));
+            auto out = (QRgb*) (pixels + y * stride);
+            for(int x = rect.left(); x <= rect.right(); x++) {
+                auto left = std::min(2 * x, lastColumn);
+                auto right = std::min(2 * x + 1, lastColumn);
+                QRgb pixels[4] = {first[left], first[right], second[left], second[right]};
+                int red = 2, green = 2, blue = 2, alpha = 2;
+                for(auto pixel : pixels) {
+                    red += qRed(pixel);
+                    green += qGreen(pixel);
+                    blue += qBlue(pixel);
+                    alpha += qAlpha(pixel);
+                }
+                out[x] = qRgba(red / 4, green / 4, blue / 4, alpha / 4);
+            }
+        }
+    });
+}
+
+// Grayscale8 images stay single-channel all the way down the pyramid; they
+// are only expanded to RGB when a tile is turned into a pixmap.
+static QImage toViewFormat(QImage image) {
+    if(image.depth() == 32 || image.format() == QImage::Format_Grayscale8)
+        return image;
+    return image.convertToFormat(QImage::Format_RGB32);
+}
+
+static double zoomForLevel(int level) {
+    return std::ldexp(1.0, level);
+}
+
+ImageViewport::ImageViewport(QWidget *parent) : QAbstractScrollArea(parent) {
+    tiles.setMaxCost(VIEWPORT_CACHE_BYTES / 1024);
+    setFocusPolicy(Qt::StrongFocus);
+    viewport()->setAttribute(Qt::WA_OpaquePaintEvent);
+    horizontalScrollBar()->setSingleStep(VIEWPORT_TILE_SIZE / 4);
+    verticalScrollBar()->setSingleStep(VIEWPORT_TILE_SIZE / 4);
+}
+
+void ImageViewport::setImage(QImage image) {
+    levels.clear();
+    levels.push_back(toViewFormat(image));
+    sourceScale = 1;
+    tiles.clear();
+    if(logicalSize != image.size()) {
+        logicalSize = image.size();
+        clearSelection();
+        if(!fitted)
+            zoomToFit();
+        updateScrollBars();
+    }
+    viewport()->update();
+}
+
+void ImageViewport::setImage(QImage image, QRect dirty) {
+    auto converted = toViewFormat(image);
+    if(levels.empty() || sourceScale != 1 || image.size() != logicalSize || converted.format() != levels[0].format()) {
+        setImage(converted);
+        return;
+    }
+    // Only the dirty rows are copied into the level the viewport owns.
+    // Taking converted itself would leave its buffer shared with the caller,
+    // and the caller's next in-place edit would then deep-copy the whole
+    // image just to detach from the viewport.
+    dirty = dirty.intersected(converted.rect());
+    if(converted.constBits() != levels[0].constBits() && !dirty.isEmpty()) {
+        auto bytes = dirty.width() * converted.depth() / 8;
+        auto offset = dirty.left() * converted.depth() / 8;
+        auto pixels = levels[0].bits();
+        auto stride = levels[0].bytesPerLine();
+        for(int y = dirty.top(); y <= dirty.bottom(); y++)
+            memcpy(pixels + y * stride + offset, converted.constScanLine(y) + offset, bytes);
+    }
+    invalidate(dirty);
+}
+
+void ImageViewport::setPreview(QImage preview, QSize fullSize) {
+    levels.clear();
+    levels.push_back(toViewFormat(preview));
+    sourceScale = preview.width() / (double) std::max(1, fullSize.width());
+    tiles.clear();
+    if(logicalSize != fullSize) {
+        logicalSize = fullSize;
+        clearSelection();
+        if(!fitted)
+            zoomToFit();
+        updateScrollBars();
+    }
+    viewport()->update();
+}
+
+void ImageViewport::setSelectionEnabled(bool enabled) {
+    selectionEnabled = enabled;
+    if(!enabled)
+        clearSelection();
+}
+
+void ImageViewport::clearSelection() {
+    selecting = false;
+    if(!selection.isEmpty())
+        viewport()->update();
+    selection = QRect();
+    if(selectionChanged)
+        selectionChanged(QRect());
+}
+
+double ImageViewport::zoom() const {
+    return zoomForLevel(zoomLevel);
+}
+
+void ImageViewport::setZoomLevel(int level, QPoint anchor) {
+    level = std::clamp(level, VIEWPORT_MIN_ZOOM_LEVEL, VIEWPORT_MAX_ZOOM_LEVEL);
+    if(level == zoomLevel)
+        return;
+    auto imagePoint = toImage(anchor);
+    zoomLevel = level;
+    updateScrollBars();
+    horizontalScrollBar()->setValue(std::lround(imagePoint.x() * zoom() - anchor.x()));
+    verticalScrollBar()->setValue(std::lround(imagePoint.y() * zoom() - anchor.y()));
+    viewport()->update();
+}
+
+void ImageViewport::zoomToFit() {
+    if(logicalSize.isEmpty())
+        return;
+    QSize available = viewport()->size();
+    if(!isVisible() || available.width() < 64 || available.height() < 64) {
+        auto screen = QGuiApplication::primaryScreen();
+        available = screen ? screen->availableGeometry().size() * 0.8 : QSize(1024, 768);
+    }
+    auto ratio = std::min(available.width() / (double) logicalSize.width(), available.height() / (double) logicalSize.height());
+    zoomLevel = std::clamp((int) std::floor(std::log2(ratio)), VIEWPORT_MIN_ZOOM_LEVEL, 0);
+    fitted = true;
+    updateScrollBars();
+    viewport()->update();
+}
+
+QSize ImageViewport::sizeHint() const {
+    auto frame = 2 * frameWidth();
+    auto hint = contentSize() + QSize(frame, frame);
+    if(auto screen = QGuiApplication::primaryScreen())
+        hint = hint.boundedTo(screen->availableGeometry().size() * 0.8);
+    return hint.expandedTo(QSize(320, 240));
+}
+
+QSize ImageViewport::contentSize() const {
+    return QSize(std::ceil(logicalSize.width() * zoom()), std::ceil(logicalSize.height() * zoom()));
+}
+
+QPoint ImageViewport::contentOrigin() const {
+    auto content = contentSize();
+    auto view = viewport()->size();
+    return QPoint(std::max(0, (view.width() - content.width()) / 2) - horizontalScrollBar()->value(),
+                  std::max(0, (view.height() - content.height()) / 2) - verticalScrollBar()->value());
+}
+
+QPointF ImageViewport::toImage(QPoint point) const {
+    return QPointF(point - contentOrigin()) / zoom();
+}
+
+QRect ImageViewport::toView(QRect rect) const {
+    auto origin = contentOrigin();
+    return QRectF(rect.x() * zoom() + origin.x(), rect.y() * zoom() + origin.y(), rect.width() * zoom(), rect.height() * zoom()).toAlignedRect();
+}
+
+void ImageViewport::updateScrollBars() {
+    auto content = contentSize();
+    auto view = viewport()->size();
+    horizontalScrollBar()->setRange(0, std::max(0, content.width() - view.width()));
+    horizontalScrollBar()->setPageStep(view.width());
+    verticalScrollBar()->setRange(0, std::max(0, content.height() - view.height()));
+    verticalScrollBar()->setPageStep(view.height());
+}
+
+const QImage &ImageViewport::level(int index) {
+    while((int) levels.size() <= index) {
+        TraceScope scope("viewportLevel", "upload");
+        auto &previous = levels.back();
+        QImage next((previous.width() + 1) / 2, (previous.height() + 1) / 2, previous.format());
+        downsampleRegion(previous, next, next.rect());
+        levels.push_back(next);
+    }
+    return levels[index];
+}
+
+QPixmap ImageViewport::tile(int column, int row) {
+    auto key = ((quint64) (zoomLevel - VIEWPORT_MIN_ZOOM_LEVEL) << 48) | ((quint64) row << 24) | (quint64) column;
+    if(auto cached = tiles.object(key))
+        return *cached;
+    auto content = QRect(column * VIEWPORT_TILE_SIZE, row * VIEWPORT_TILE_SIZE, VIEWPORT_TILE_SIZE, VIEWPORT_TILE_SIZE)
+                       .intersected(QRect(QPoint(0, 0), contentSize()));
+    // Pick the smallest pyramid level that still has at least one source
+    // pixel per screen pixel, then scale the remaining factor (0.5, 1] or,
+    // when zoomed in past 1:1, replicate pixels.
+    auto pixelScale = zoom() / sourceScale;
+    auto index = 0;
+    while(pixelScale * std::ldexp(1.0, index + 1) <= 1 && (levels[0].width() >> (index + 1)) > 0 && (levels[0].height() >> (index + 1)) > 0)
+        index++;
+    auto &source = level(index);
+    auto factor = pixelScale * std::ldexp(1.0, index);
+    QImage rendered;
+    if(factor == 1) {
+        rendered = source.copy(content);
+    } else {
+        rendered = QImage(content.size(), QImage::Format_RGB32);
+        rendered.fill(Qt::black);
+        QPainter painter(&rendered);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform, factor < 1);
+        auto sourceRect = QRectF(content.x() / factor, content.y() / factor, content.width() / factor, content.height() / factor);
+        painter.drawImage(QRectF(QPointF(0, 0), QSizeF(content.size())), source, sourceRect);
+    }
+    auto pixmap = QPixmap::fromImage(rendered);
+    tiles.insert(key, new QPixmap(pixmap), std::max<qint64>(1, (qint64) content.width() * content.height() * 4 / 1024));
+    return pixmap;
+}
+
+void ImageViewport::invalidate(QRect dirty) {
+    dirty = dirty.intersected(QRect(QPoint(0, 0), logicalSize));
+    if(dirty.isEmpty())
+        return;
+    TraceScope scope("viewportInvalidate", "upload");
+    auto region = dirty;
+    for(size_t index = 1; index < levels.size(); index++) {
+        region = QRect(QPoint(region.left() / 2, region.top() / 2), QPoint(region.right() / 2, region.bottom() / 2)).intersected(levels[index].rect());
+        downsampleRegion(levels[index - 1], levels[index], region);
+    }
+    for(auto key : tiles.keys()) {
+        auto tileZoom = zoomForLevel((int) (key >> 48) + VIEWPORT_MIN_ZOOM_LEVEL);
+        auto row = (int) ((key >> 24) & 0xffffff);
+        auto column = (int) (key & 0xffffff);
+        // Smoothing reads about one source pixel beyond the tile edge.
+        auto margin = 2 / tileZoom;
+        auto extent = VIEWPORT_TILE_SIZE / tileZoom;
+        auto rect = QRectF(column * extent - margin, row * extent - margin, extent + 2 * margin, extent + 2 * margin);
+        if(rect.intersects(QRectF(dirty)))
+            tiles.remove(key);
+    }
+    viewport()->update(toView(dirty).adjusted(-2, -2, 2, 2));
+}
+
+void ImageViewport::paintEvent(QPaintEvent *event) {
+    QPainter painter(viewport());
+    painter.fillRect(event->rect(), palette().dark());
+    if(levels.empty())
+        return;
+    auto origin = contentOrigin();
+    auto visible = event->rect().translated(-origin).intersected(QRect(QPoint(0, 0), contentSize()));
+    if(!visible.isEmpty()) {
+        for(int row = visible.top() / VIEWPORT_TILE_SIZE; row <= visible.bottom() / VIEWPORT_TILE_SIZE; row++)
+            for(int column = visible.left() / VIEWPORT_TILE_SIZE; column <= visible.right() / VIEWPORT_TILE_SIZE; column++)
+                painter.drawPixmap(origin + QPoint(column * VIEWPORT_TILE_SIZE, row * VIEWPORT_TILE_SIZE), tile(column, row));
+        static bool firstPixel = true;
+        if(firstPixel) {
+            firstPixel = false;
+            Trace::instance().milestone("timeToFirstPixel");
+        }
+    }
+    if(!selection.isEmpty()) {
+        auto rect = toView(selection).adjusted(0, 0, -1, -1);
+        painter.setPen(QPen(Qt::black, 1));
+        painter.drawRect(rect);
+        painter.setPen(QPen(Qt::white, 1, Qt::DashLine));
+        painter.drawRect(rect);
+    }
+}
+
+void ImageViewport::resizeEvent(QResizeEvent *event) {
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void ImageViewport::scrollContentsBy(int, int) {
+    viewport()->update();
+}
+
+void ImageViewport::wheelEvent(QWheelEvent *event) {
+    if(!(event->modifiers() & Qt::ControlModifier) || event->angleDelta().y() == 0) {
+        QAbstractScrollArea::wheelEvent(event);
+        return;
+    }
+    setZoomLevel(zoomLevel + (event->angleDelta().y() > 0 ? 1 : -1), event->position().toPoint());
+    event->accept();
+}
+
+void ImageViewport::keyPressEvent(QKeyEvent *event) {
+    auto center = viewport()->rect().center();
+    switch(event->key()) {
+    case Qt::Key_Plus:
+    case Qt::Key_Equal:
+        setZoomLevel(zoomLevel + 1, center);
+        break;
+    case Qt::Key_Minus:
+        setZoomLevel(zoomLevel - 1, center);
+        break;
+    case Qt::Key_0:
+        zoomToFit();
+        break;
+    case Qt::Key_1:
+        setZoomLevel(0, center);
+        break;
+    default:
+        QAbstractScrollArea::keyPressEvent(event);
+    }
+}
+
+void ImageViewport::mousePressEvent(QMouseEvent *event) {
+    auto position = event->position().toPoint();
+    if(event->button() == Qt::MiddleButton || (event->button() == Qt::LeftButton && !selectionEnabled)) {
+        panning = true;
+        lastPan = position;
+        viewport()->setCursor(Qt::ClosedHandCursor);
+        return;
+    }
+    if(!selectionEnabled)
+        return;
+    if(event->button() == Qt::RightButton) {
+        clearSelection();
+        return;
+    }
+    selecting = true;
+    origin = position;
+}
+
+void ImageViewport::mouseMoveEvent(QMouseEvent *event) {
+    auto position = event->position().toPoint();
+    if(panning) {
+        auto delta = position - lastPan;
+        lastPan = position;
+        horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta.x());
+        verticalScrollBar()->setValue(verticalScrollBar()->value() - delta.y());
+        return;
+    }
+    if(!selecting)
+        return;
+    auto previous = selection;
+    selection = QRectF(toImage(origin), toImage(position)).normalized().toAlignedRect().intersected(QRect(QPoint(0, 0), logicalSize));
+    viewport()->update(toView(previous.united(selection)).adjusted(-2, -2, 2, 2));
+}
+
+void ImageViewport::mouseReleaseEvent(QMouseEvent *event) {
+    if(panning) {
+        panning = false;
+        viewport()->unsetCursor();
+        return;
+    }
+    if(!selecting)
+        return;
+    mouseMoveEvent(event);
+    selecting = false;
+    if(selection.width() < 2 || selection.height() < 2) {
+        clearSelection();
+        return;
+    }
+    if(selectionChanged)
+        selectionChanged(selection);
+}
@@ -0,0 +1,86 @@
+#ifndef IMAGE_VIEWPORT_H
+#define IMAGE_VIEWPORT_H
+
+#include <QAbstractScrollArea>
+#include <QCache>
+#include <QImage>
+#include <QPixmap>
+
+#include <functional>
+#include <vector>
+
+#define VIEWPORT_TILE_SIZE 256
+#define VIEWPORT_CACHE_BYTES (256LL * 1024 * 1024)
+#define VIEWPORT_MIN_ZOOM_LEVEL -8
+#define VIEWPORT_MAX_ZOOM_LEVEL 5
+
+// Scrollable, zoomable view of the working image. The image is kept as a
+// pyramid of 2x2 box-filtered levels and the screen is drawn from
+// VIEWPORT_TILE_SIZE tiles rendered from the closest level, cached per zoom
+// level. Only the tiles in view are ever rendered, and a dirty rectangle
+// refreshes the pyramid and drops the cached tiles for that rectangle only.
+// Ctrl+wheel or +/- zoom around the cursor, 0 fits the window, 1 shows
+// pixels 1:1. Middle drag pans; left drag selects when selection is enabled,
+// right click clears the selection.
+class ImageViewport : public QAbstractScrollArea {
+public:
+    ImageViewport(QWidget *parent = nullptr);
+
+    void setImage(QImage image);
+    // Refreshes dirty from image, which must have the size and format of
+    // the image last set. Only those pixels are copied.
+    void setImage(QImage image, QRect dirty);
+    void setPreview(QImage preview, QSize fullSize);
+
+    void setSelectionEnabled(bool enabled);
+    void clearSelection();
+
+    QSize imageSize() const {
+        return logicalSize;
+    }
+
+    double zoom() const;
+    void setZoomLevel(int level, QPoint anchor);
+    void zoomToFit();
+
+    QSize sizeHint() const override;
+
+    std::function<void(QRect)> selectionChanged;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+
+private:
+    std::vector<QImage> levels;
+    QSize logicalSize;
+    double sourceScale = 1;
+    int zoomLevel = 0;
+    bool fitted = false;
+    QCache<quint64, QPixmap> tiles;
+
+    bool selectionEnabled = false;
+    bool selecting = false;
+    bool panning = false;
+    QPoint origin;
+    QPoint lastPan;
+    QRect selection;
+
+    QSize contentSize() const;
+    QPoint contentOrigin() const;
+    QPointF toImage(QPoint point) const;
+    QRect toView(QRect rect) const;
+    void updateScrollBars();
+
+    const QImage &level(int index);
+    QPixmap tile(int column, int row);
+    void invalidate(QRect dirty);
+};
+
+#endif // IMAGE_VIEWPORT_H
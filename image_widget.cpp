@@ -1,19 +1,32 @@
 #include <QGridLayout>
 #include <QWidget>
-#include <qlabel.h>
 #include <QWindow>
+#include <QImageReader>
+#include <QFutureWatcher>
 
 #include <QtConcurrent/QtConcurrent>
 
-#include <QtCharts/QChart>
-#include <QtCharts/QStackedBarSeries>
-#include <QtCharts/QBarSet>
-#include <QtCharts/QBarCategoryAxis>
-#include <QtCharts/QValueAxis>
-#include <QtCharts/QChartView>
-
 #include <bits/stdc++.h>
 
+#include "bilateral_grid.h"
+#include "blur.h"
+#include "buffer_pool.h"
+#include "clahe.h"
+#include "encoder.h"
+#include "histogram_match.h"
+#include "image_comparison.h"
+#include "image_cache.h"
+#include "image_statistics.h"
+#include "image_viewport.h"
+#include "io.h"
+#include "morphology.h"
+#include "palette.h"
+#include "planar_image.h"
+#include "rank_filter.h"
+#include "raw_image.h"
+#include "tiled_image.h"
+#include "trace.h"
+
 struct ImageData {
     int width, height;
     int size;
@@ -30,275 +43,526 @@ public:
     }
 
     static ImageWidget* create(QString title, QString imagePath) {
-        QPixmap pix(imagePath);
         auto window = new QWidget;
         QGridLayout *layout = new QGridLayout(window);
-        auto image = new QLabel(QString());
+        auto image = new ImageViewport;
         layout->setContentsMargins(0, 0, 0, 0);
-        layout->addWidget(image, 0, 0, Qt::AlignCenter);
+        layout->addWidget(image, 0, 0);
         window->setLayout(layout);
         window->setWindowTitle(title);
         auto result = new ImageWidget(window, image, imagePath);
-        result->updateImage(pix);
+        result->load(imagePath);
+        window->resize(image->sizeHint());
         window->show();
         return result;
     }
 
+    // Window showing an image that has no file, such as a difference
+    // heatmap.
+    static ImageWidget* create(QString title, QImage source) {
+        auto result = create(title, QString());
+        result->updateImage(source);
+        result->window->resize(result->image->sizeHint());
+        return result;
+    }
+
+    // Histogram windows are opened through this hook, which the GUI sets to
+    // showHistogramWindow(). Headless widgets and fpi_bench leave it empty
+    // and do not need Qt Charts at all.
+    static void setHistogramViewer(std::function<void(QString, const ChannelStatistics&)> viewer) {
+        histogramViewer() = viewer;
+    }
+
+    static ImageWidget* createHeadless(QImage source) {
+        auto result = new ImageWidget(nullptr, nullptr, QString());
+        result->updateImage(source);
+        return result;
+    }
+
+    ~ImageWidget() {
+        waitForTiledSaves();
+        delete tiled;
+    }
+
+    QImage getImage() {
+        return currentImage();
+    }
+
+    std::vector<quint64> histogram() {
+        auto luminance = luminanceStatistics();
+        return std::vector<quint64>(luminance.counts, luminance.counts + 256);
+    }
+
+    ImageStatistics statistics() {
+        OperationTrace trace("statistics", pixelCount());
+        if(tiled) {
+            ImageStatistics result;
+            QMutex mutex;
+            tiled->forEachTile([&result, &mutex](QImage tile) {
+                auto partial = imageStatistics(tile, tile.rect());
+                QMutexLocker locker(&mutex);
+                result.add(partial);
+            });
+            return result;
+        }
+        return imageStatistics(currentImage(), roi.isEmpty() ? currentImage().rect() : roi);
+    }
+
+    // Difference between reference (typically the original window's image)
+    // and this image. Tiled images compare their previews.
+    ImageComparison compare(QImage reference) {
+        OperationTrace trace("compare", pixelCount());
+        return compareImages(reference, currentImage());
+    }
+
+    QImage differenceHeatmap(QImage reference) {
+        OperationTrace trace("differenceHeatmap", pixelCount());
+        return ::differenceHeatmap(reference, currentImage());
+    }
+
+    void enableSelection() {
+        if(image == nullptr)
+            return;
+        image->selectionChanged = [this](QRect selection) {
+            roi = selection;
+        };
+        image->setSelectionEnabled(true);
+    }
+
+    void setRoi(QRect rect) {
+        roi = rect.intersected(current.rect());
+    }
+
+    QRect getRoi() {
+        return roi;
+    }
+
     void refreshImage(QString imagePath) {
-        updateImage(QPixmap(imagePath));
+        OperationTrace trace("load", 0);
+        load(imagePath);
     }
 
+    // Whole images become Format_Grayscale8, one byte per pixel, and every
+    // later op runs on that single channel. Tiles and selections stay RGB32
+    // with R=G=B since they share storage with colour pixels.
     void grayscale() {
-        updateImage(grayscale(image->pixmap().toImage()));
+        OperationTrace trace("grayscale", pixelCount());
+        if(!tiled && currentImage().format() == QImage::Format_Grayscale8)
+            return;
+        if(tiled || !roi.isEmpty()) {
+            applyPixels(grayscalePixel);
+            return;
+        }
+        auto result = grayscaleImage(currentImage());
+        updateImage(result);
     }
 
     void mirrorVertically() {
-        auto pixmap = image->pixmap();
-        auto convertedImage = pixmap.toImage();
-        auto height = convertedImage.height();
-        auto width = convertedImage.width();
-        QRgb *bits = (QRgb*) convertedImage.bits();
-        for(int column = 0; column < width; column++) {
-            for(int row = 0; row < height / 2; row++) {
-                auto pixel = column + row * width;
-                auto mirror_pixel = column + (height - 1 - row) * width;
-                QRgb aux = bits[pixel];
-                bits[pixel] = bits[mirror_pixel];
-                bits[mirror_pixel] = aux;
-            }
-        }
-        updateImage(convertedImage);
+        OperationTrace trace("mirrorVertically", pixelCount());
+        if(tiled)
+            return;
+        auto newImage = mirrorImage(currentImage(), false);
+        updateImage(newImage);
     }
 
     void mirrorHorizontally() {
-        auto pixmap = image->pixmap();
-        auto convertedImage = pixmap.toImage();
-        auto height = convertedImage.height();
-        auto width = convertedImage.width();
-        QRgb *bits = (QRgb*) convertedImage.bits();
-        for(int i = 0; i < height; i++) {
-            QRgb aux[width / 2];
-            auto line_start = bits + i * width;
-            std::reverse_copy(line_start + (int) ceil(width / 2), line_start + width, aux);
-            std::reverse_copy(line_start, line_start + (int) (width / 2) + 1, line_start + (int) ceil(width / 2));
-            memmove(line_start, aux, sizeof(QRgb) * (int) (width / 2));
-        }
-        updateImage(convertedImage);
+        OperationTrace trace("mirrorHorizontally", pixelCount());
+        if(tiled)
+            return;
+        auto newImage = mirrorImage(currentImage(), true);
+        updateImage(newImage);
     }
 
+    // With a selection, the tone range comes from the selection alone and
+    // only it is rewritten.
     void quantize(uint8_t tones) {
-        if(tones == 0)
-            return;
-        int min_tone = 256, max_tone = 0;
-        auto result = onPixels([&min_tone, &max_tone](ImageData data) {
-            auto tone = qRed(data.pixels[data.index]);
-            if(tone > max_tone)
-                max_tone = tone;
-            if(tone < min_tone)
-                min_tone = tone;
-        });
+        OperationTrace trace("quantize", pixelCount());
+        if(tones == 0 || tiled)
+            return;
+        int min_tone, max_tone;
+        {
+            TraceScope scope("statistics");
+            auto area = roi.isEmpty() ? currentImage().rect() : roi;
+            auto tone = imageStatistics(currentImage(), area).channel[0];
+            min_tone = tone.minimum();
+            max_tone = tone.maximum();
+        }
         int intervals = max_tone - min_tone + 1;
         if(tones >= intervals)
             return;
         auto offset = min_tone - 0.5f;
-        float intervalLength = intervals / tones;
-        result = onPixels(result, [offset, intervalLength, this](ImageData data) {
+        float intervalLength = intervals / (float) tones;
+        if(currentImage().format() == QImage::Format_Grayscale8) {
+            ChannelLookup lookup;
+            for(int i = 0; i < 256; i++)
+                lookup.table[0][i] = i < min_tone || i > max_tone ? i : retrieveNewQuantizedColor(i, offset, intervalLength);
+            applyChannelLookup(lookup);
+            return;
+        }
+        applyPixels([offset, intervalLength, this](ImageData data) {
             auto newColor = retrieveNewQuantizedColor(qRed(data.pixels[data.index]), offset, intervalLength);
-            data.pixels[data.pixels[data.index]] = QColor(newColor, newColor, newColor).rgb();
+            data.pixels[data.index] = QColor(newColor, newColor, newColor).rgb();
         });
+    }
+
+    void quantizeColors(int colors) {
+        OperationTrace trace("quantizeColors", pixelCount());
+        if(tiled) {
+            auto palette = Palette::build(tiled->preview(), colors);
+            TraceScope scope("mapTiles");
+            if(!tiled->mapTiles([&palette](QImage tile) {
+                applyPalette(tile, tile.rect(), palette);
+                return tile;
+            }))
+                qWarning("Quantizing the tiled image failed; some tiles may be unchanged");
+            updateImage(tiled->preview());
+            return;
+        }
+        expandGrayscale();
+        Palette palette;
+        {
+            TraceScope scope("buildPalette");
+            palette = Palette::build(roi.isEmpty() ? currentImage() : BufferPool::instance().copy(currentImage(), roi), colors);
+        }
+        TraceScope scope("assignPalette");
+        if(!roi.isEmpty()) {
+            applyPalette(currentImage(), roi, palette);
+            updateRegion(roi);
+            return;
+        }
+        auto result = BufferPool::instance().copy(currentImage());
+        applyPalette(result, result.rect(), palette);
         updateImage(result);
     }
 
     void showHistogram() {
-        showHistogram("Histogram", image->pixmap().toImage());
+        OperationTrace trace("histogram", pixelCount());
+        showHistogram("Histogram", luminanceStatistics());
     }
 
     void saveAsJPG(QString path) {
-        image->pixmap().save(path);
+        save(path, ImageEncoder::settingsFor(path, -1)).waitForFinished();
+    }
+
+    // Tiled images are streamed from their store rather than snapshotted;
+    // edits to them wait for the saves in flight (see TiledImage::saveLock).
+    QFuture<bool> save(QString path, EncoderSettings settings) {
+        if(tiled) {
+            auto store = tiled;
+            auto future = QtConcurrent::run(ImageEncoder::pool(), [store, path, settings]() {
+                return store->save(path, settings);
+            });
+            for(int i = tiledSaves.size() - 1; i >= 0; i--)
+                if(tiledSaves[i].isFinished())
+                    tiledSaves.removeAt(i);
+            tiledSaves << future;
+            return future;
+        }
+        return ImageEncoder::encodeAsync(currentImage(), path, settings);
     }
 
     void addBrightness(int brightness) {
-        auto result = onPixels([brightness, this](ImageData data) {
-            auto pixel = data.pixels[data.index];
-            auto red = brightness + qRed(pixel);
-            auto green = brightness + qGreen(pixel);
-            auto blue = brightness + qBlue(pixel);
-            data.pixels[data.index] = QColor(coerceWithinRange(red), coerceWithinRange(green), coerceWithinRange(blue)).rgb();
-        });
-        updateImage(result);
+        OperationTrace trace("addBrightness", pixelCount());
+        ChannelLookup lookup;
+        for(int i = 0; i < 256; i++)
+            lookup.table[0][i] = lookup.table[1][i] = lookup.table[2][i] = coerceWithinRange(brightness + i);
+        applyChannelLookup(lookup);
     }
 
     void addContrast(int contrast) {
-        auto result = onPixels([contrast, this](ImageData data) {
-            auto pixel = data.pixels[data.index];
-            auto red = contrast * qRed(pixel);
-            auto green = contrast * qGreen(pixel);
-            auto blue = contrast * qBlue(pixel);
-            data.pixels[data.index] = QColor(coerceWithinRange(red), coerceWithinRange(green), coerceWithinRange(blue)).rgb();
-        });
-        updateImage(result);
+        OperationTrace trace("addContrast", pixelCount());
+        ChannelLookup lookup;
+        for(int i = 0; i < 256; i++)
+            lookup.table[0][i] = lookup.table[1][i] = lookup.table[2][i] = coerceWithinRange(contrast * i);
+        applyChannelLookup(lookup);
     }
 
     void negative() {
-        auto result = onPixels([](ImageData data) {
-            auto pixel = data.pixels[data.index];
-            auto red = 255 - qRed(pixel);
-            auto green = 255 - qGreen(pixel);
-            auto blue = 255 - qBlue(pixel);
-            data.pixels[data.index] = QColor(red, green, blue).rgb();
-        });
-        updateImage(result);
+        OperationTrace trace("negative", pixelCount());
+        ChannelLookup lookup;
+        for(int i = 0; i < 256; i++)
+            lookup.table[0][i] = lookup.table[1][i] = lookup.table[2][i] = 255 - i;
+        applyChannelLookup(lookup);
     }
 
     void equalize() {
-        auto imageAux = image->pixmap().toImage();
-        auto cumulativeHistogram = calculateNormalizedHistogram();
-        auto result = onPixels([cumulativeHistogram](ImageData data) {
-            auto pixel = data.pixels[data.index];
-            data.pixels[data.index] = QColor(cumulativeHistogram[qRed(pixel)], cumulativeHistogram[qGreen(pixel)], cumulativeHistogram[qBlue(pixel)]).rgb();
-        });
+        OperationTrace trace("equalize", pixelCount());
+        auto originalHistogram = regionLuminanceStatistics();
+        if(originalHistogram.total == 0)
+            return;
+        auto factor = 255.0 / originalHistogram.total;
+        ChannelLookup lookup;
+        double sum = 0;
+        for(int i = 0; i < 256; i++) {
+            sum += factor * originalHistogram.counts[i];
+            lookup.table[0][i] = lookup.table[1][i] = lookup.table[2][i] = std::min<uint32_t>(255, sum);
+        }
+        applyChannelLookup(lookup);
+        showHistogram("Original histogram", originalHistogram);
+        showHistogram("New histogram", regionLuminanceStatistics());
+    }
+
+    void equalizeAdaptive(double clipLimit) {
+        OperationTrace trace("equalizeAdaptive", pixelCount());
+        if(tiled)
+            return;
+        ClaheSettings settings;
+        settings.clipLimit = clipLimit;
+        if(!roi.isEmpty()) {
+            clahe(currentImage(), roi, settings);
+            updateRegion(roi);
+            return;
+        }
+        auto result = BufferPool::instance().copy(currentImage());
+        clahe(result, result.rect(), settings);
         updateImage(result);
-        showHistogram("Original histogram", imageAux);
-        showHistogram("New histogram", result);
+    }
+
+    void median(int radius) {
+        rankFilter(radius, 0.5);
+    }
+
+    void rankFilter(int radius, double percentile) {
+        OperationTrace trace("rankFilter", pixelCount());
+        radius = std::clamp(radius, 1, RANK_FILTER_MAX_RADIUS);
+        filterNeighbourhood(radius, [radius, percentile](const PlanarImage &source, PlanarImage &result) {
+            rankFilterPlanar(source, result, radius, percentile);
+        });
+    }
+
+    void boxBlur(int radius) {
+        OperationTrace trace("boxBlur", pixelCount());
+        radius = std::clamp(radius, 1, BLUR_MAX_RADIUS);
+        filterNeighbourhood(radius, [radius](const PlanarImage &source, PlanarImage &result) {
+            boxBlurPlanar(source, result, radius);
+        });
+    }
+
+    void gaussianBlur(double sigma) {
+        OperationTrace trace("gaussianBlur", pixelCount());
+        sigma = std::clamp(sigma, GAUSSIAN_MIN_SIGMA, GAUSSIAN_MAX_SIGMA);
+        filterNeighbourhood(gaussianHalo(sigma), [sigma](const PlanarImage &source, PlanarImage &result) {
+            gaussianBlurPlanar(source, result, sigma);
+        });
+    }
+
+    void bilateral(double spatialSigma, double rangeSigma) {
+        OperationTrace trace("bilateral", pixelCount());
+        filterNeighbourhood(bilateralHalo(spatialSigma), [spatialSigma, rangeSigma](const PlanarImage &source, PlanarImage &result) {
+            bilateralGridPlanar(source, result, spatialSigma, rangeSigma);
+        });
+    }
+
+    void morphology(MorphologyOperation operation, int radiusX, int radiusY) {
+        OperationTrace trace("morphology", pixelCount());
+        radiusX = std::clamp(radiusX, 0, MORPHOLOGY_MAX_RADIUS);
+        radiusY = std::clamp(radiusY, 0, MORPHOLOGY_MAX_RADIUS);
+        // Opening and closing run two passes, so each reads twice as far.
+        auto passes = operation == MorphologyOperation::Erode || operation == MorphologyOperation::Dilate ? 1 : 2;
+        filterNeighbourhood(passes * std::max(radiusX, radiusY), [operation, radiusX, radiusY](const PlanarImage &source, PlanarImage &result) {
+            morphologyPlanar(source, result, operation, radiusX, radiusY);
+        });
+    }
+
+    void matchHistogram(QString referencePath) {
+        ChannelHistograms reference;
+        if(ReferenceHistogramCache::instance().histograms(referencePath, reference))
+            matchHistogram(reference);
     }
 
     void matchHistogram(QImage target) {
-        grayscale();
-        int histogramMatch[256];
-        auto sourceHistogram = calculateNormalizedHistogram(image->pixmap().toImage());
-        auto targetHistogram = calculateNormalizedHistogram(grayscale(target));
-        for(int i = 0; i < 256; i++)
-            histogramMatch[i] = findClosestShade(sourceHistogram, targetHistogram, i);
-        updateImage(onPixels([histogramMatch](ImageData data) {
-            auto shade = qRed(data.pixels[data.index]);
-            data.pixels[data.index] = QColor(histogramMatch[shade], histogramMatch[shade], histogramMatch[shade]).rgb();
-        }));
-        delete sourceHistogram;
-        delete targetHistogram;
+        matchHistogram(channelHistograms(target));
+    }
+
+    void matchHistogram(const ChannelHistograms &reference) {
+        OperationTrace trace("matchHistogram", pixelCount());
+        auto gray = !tiled && currentImage().format() == QImage::Format_Grayscale8;
+        applyChannelLookup(histogramMapping(sourceHistograms(), gray ? reference.pooled() : reference));
     }
 
     void zoomOut(int offsetX, int offsetY) {
-        QImage newImage = QImage(ceil(image->pixmap().width() / (double) offsetX), ceil(image->pixmap().height() / (double) offsetY), QImage::Format_RGB32);
-        auto pixels = (QRgb*) newImage.bits();
-        auto currentPixel = 0;
-        onPixels([&currentPixel, pixels, offsetX, offsetY](ImageData data) {
-            int count = 0;
-            int red = 0, green = 0, blue = 0;
-            if(data.columnIndex % offsetX != 0)
-                return;
-            if(data.rowIndex % offsetY != 0)
-                return;
-            for(int x = 0; x < offsetX; x++) {
-                for(int y = 0; y < offsetY; y++) {
-                    auto targetPixelIndex = data.index + x + y * data.width;
-                    if(data.columnIndex + x >= data.width || data.columnIndex + x < 0)
-                        continue;
-                    if(data.rowIndex + y >= data.height || data.rowIndex + y < 0)
-                        continue;
-                    red += qRed(data.pixels[targetPixelIndex]);
-                    green += qGreen(data.pixels[targetPixelIndex]);
-                    blue += qBlue(data.pixels[targetPixelIndex]);
-                    count++;
-                }
-            }
-            if(count == 0)
-                return;
-            pixels[currentPixel++] = QColor(red / count, green / count, blue / count).rgb();
-        });
-        updateImage(newImage);
+        OperationTrace trace("zoomOut", pixelCount());
+        if(tiled)
+            return;
+        if(offsetX <= 0 || offsetY <= 0)
+            return;
+        auto result = zoomOutPlanar(planarImage(), offsetX, offsetY);
+        updatePlanar(result);
     }
 
     void rotateLeft() {
-        QImage newImage = QImage(image->pixmap().height(), image->pixmap().width(), QImage::Format_RGB32);
-        auto pixels = (QRgb*) newImage.bits();
-        onPixels([pixels](ImageData data) {
-            pixels[(data.width - data.columnIndex - 1) * data.height + data.rowIndex] = data.pixels[data.index];
-        });
+        OperationTrace trace("rotateLeft", pixelCount());
+        if(tiled)
+            return;
+        auto newImage = rotateImage(currentImage(), false);
         updateImage(newImage);
     }
 
     void rotateRight() {
-        QImage newImage = QImage(image->pixmap().height(), image->pixmap().width(), QImage::Format_RGB32);
-        auto pixels = (QRgb*) newImage.bits();
-        onPixels([pixels](ImageData data) {
-            pixels[data.columnIndex * data.height + (data.height - data.rowIndex - 1)] = data.pixels[data.index];
-        });
+        OperationTrace trace("rotateRight", pixelCount());
+        if(tiled)
+            return;
+        auto newImage = rotateImage(currentImage(), true);
         updateImage(newImage);
     }
 
     void zoomIn() {
-        QImage newImage = QImage(image->pixmap().width() * 2 - 1, image->pixmap().height() * 2 - 1, QImage::Format_RGB32);
-        auto pixels = (QRgb*) newImage.bits();
-        auto currentPixelIndex = 0;
-        auto newImageWidth = newImage.width();
-        onPixels([newImageWidth, &currentPixelIndex, pixels](ImageData data) {
-            pixels[currentPixelIndex] = data.pixels[data.index];
-            auto columnIndex = currentPixelIndex % newImageWidth;
-            if(columnIndex + 2 >= newImageWidth) {
-                currentPixelIndex += 2 * newImageWidth - columnIndex;
-                return;
-            }
-            currentPixelIndex += 2;
-        });
-        auto result = onPixels(newImage, [this](ImageData data) {
-            if(data.rowIndex % 2 == 0 && data.columnIndex % 2 == 1) {
-                QList list = QList<QRgb>();
-                list << data.pixels[data.index - 1];
-                if(data.columnIndex < data.width - 1)
-                    list << data.pixels[data.index + 1];
-                data.pixels[data.index] = average(list);
-                return;
-            }
-            if(data.rowIndex % 2 == 1) {
-                QList list = QList<QRgb>();
-                list << data.pixels[data.index - data.width];
-                if(data.rowIndex < data.height - 1)
-                    list << data.pixels[data.index + data.width];
-                data.pixels[data.index] = average(list);
-            }
-        });
-        updateImage(result);
+        OperationTrace trace("zoomIn", pixelCount());
+        if(tiled)
+            return;
+        auto result = zoomInPlanar(planarImage());
+        updatePlanar(result);
     }
 
     void convolve(double kernel[3][3], bool add) {
+        OperationTrace trace("convolve", pixelCount());
         double kernel_copy[3][3];
         memcpy(kernel_copy, kernel, sizeof(double) * 9);
         flip(kernel_copy);
-        QImage copy = image->pixmap().toImage();
-        auto pixels = (QRgb*) copy.bits();
-        auto result = onPixels([this, pixels, add, kernel_copy](ImageData data) {
-            int red = 0, green = 0, blue = 0;
-            for(int i = -1; i <= 1; i++) {
-                for(int j = -1; j <= 1; j++) {
-                    if(data.columnIndex + j < 0 || data.columnIndex + j >= data.width)
-                        return;
-                    if(data.rowIndex + i < 0 || data.rowIndex + i >= data.height)
-                        return;
-                    auto targetPixel = pixels[data.index + i * data.width + j];
-                    float factor = kernel_copy[i + 1][j + 1];
-                    red += factor * qRed(targetPixel);
-                    green += factor * qGreen(targetPixel);
-                    blue += factor * qBlue(targetPixel);
-                }
-            }
-            auto increment = add ? 127 : 0;
-            data.pixels[data.index] = QColor(coerceWithinRange(red + increment), coerceWithinRange(green + increment), coerceWithinRange(blue + increment)).rgb();
+        filterNeighbourhood(1, [&kernel_copy, add](const PlanarImage &source, PlanarImage &result) {
+            convolvePlanar(source, result, kernel_copy, add);
         });
-        updateImage(result);
     }
 
 private:
     QWidget *window;
-    QLabel *image;
+    ImageViewport *image;
     QString imagePath;
+    QImage current;
+    PlanarImage planar;
+    TiledImage *tiled = nullptr;
+    QList<QFuture<bool>> tiledSaves;
+    QFuture<QImage> pendingDecode;
+    bool decoding = false;
+    int decodeGeneration = 0;
+
+    QRect roi;
 
-    ImageWidget(QWidget *window, QLabel *image, QString imagePath) {
+    ImageWidget(QWidget *window, ImageViewport *image, QString imagePath) {
         this->window = window;
         this->image = image;
         this->imagePath = imagePath;
     }
 
-    uint8_t retrieveNewQuantizedColor(int tone, float offset, uint8_t intervalLength) {
+    // The TiledImage must outlive every save reading from it.
+    void waitForTiledSaves() {
+        for(auto &pending : tiledSaves)
+            pending.waitForFinished();
+        tiledSaves.clear();
+    }
+
+    void load(QString imagePath) {
+        TraceScope scope("decode", "decode");
+        auto decoder = decoderFor(imagePath);
+        if(decoder == nullptr)
+            return;
+        auto size = decoder->size(imagePath);
+        waitForTiledSaves();
+        delete tiled;
+        tiled = nullptr;
+        decoding = false;
+        decodeGeneration++;
+        if((qint64) size.width() * size.height() > TILED_PIXEL_THRESHOLD) {
+            tiled = TiledImage::open(imagePath, TiledImage::defaultMemoryBudget());
+            // A full decode would not fit the memory budget either.
+            if(!tiled && (qint64) size.width() * size.height() * sizeof(QRgb) > TiledImage::defaultMemoryBudget())
+                return;
+        }
+        if(tiled) {
+            updateImage(tiled->preview());
+            return;
+        }
+        auto denominator = previewScaleDenominator(size);
+        if(denominator == 1) {
+            updateImage(decodeImage(imagePath));
+            return;
+        }
+        if(decoder->supportsScaledDecode())
+            displayPreview(decodeImage(imagePath, denominator), size);
+        decoding = true;
+        pendingDecode = decodeImageAsync(imagePath);
+        auto watcher = new QFutureWatcher<QImage>(window);
+        auto generation = decodeGeneration;
+        QObject::connect(watcher, &QFutureWatcherBase::finished, window, [this, watcher, generation]() {
+            if(generation == decodeGeneration)
+                finishDecode();
+            watcher->deleteLater();
+        });
+        watcher->setFuture(pendingDecode);
+    }
+
+    void finishDecode() {
+        if(!decoding)
+            return;
+        TraceScope scope("waitForDecode", "decode");
+        decoding = false;
+        updateImage(pendingDecode.result());
+    }
+
+    qint64 pixelCount() {
+        if(tiled)
+            return (qint64) tiled->width() * tiled->height();
+        return (qint64) current.width() * current.height();
+    }
+
+    QImage &currentImage() {
+        finishDecode();
+        return current;
+    }
+
+    PlanarImage planarImage() {
+        auto &source = currentImage();
+        if(planar.isNull()) {
+            TraceScope scope("deinterleave", "convert");
+            planar = PlanarImage::fromImage(source);
+        }
+        return planar;
+    }
+
+    void updatePlanar(PlanarImage result) {
+        QImage interleaved;
+        {
+            TraceScope scope("interleave", "convert");
+            interleaved = result.toImage();
+        }
+        updateImage(interleaved);
+        planar = result;
+    }
+
+    // Runs a planar neighbourhood filter over the tiles, the selection or the
+    // whole image. halo is how far the filter reads beyond a pixel; tiles and
+    // selections are widened by it so their edges match the whole-image
+    // result.
+    void filterNeighbourhood(int halo, std::function<void(const PlanarImage&, PlanarImage&)> filter) {
+        if(tiled) {
+            TraceScope scope("mapRegions");
+            auto filtered = tiled->mapRegions(halo, [&filter](QImage region) {
+                auto source = PlanarImage::fromImage(region);
+                PlanarImage result(source.width(), source.height(), source.channels());
+                filter(source, result);
+                return result.toImage();
+            });
+            if(!filtered)
+                qWarning("Filtering the tiled image failed; it is unchanged");
+            updateImage(tiled->preview());
+            return;
+        }
+        if(!roi.isEmpty()) {
+            auto region = roi.adjusted(-halo, -halo, halo, halo).intersected(currentImage().rect());
+            auto source = PlanarImage::fromImage(BufferPool::instance().copy(current, region));
+            PlanarImage result(source.width(), source.height(), source.channels());
+            filter(source, result);
+            copyRegion(result.toImage(), roi.translated(-region.topLeft()), current, roi.topLeft());
+            updateRegion(roi);
+            return;
+        }
+        auto source = planarImage();
+        PlanarImage result(source.width(), source.height(), source.channels());
+        filter(source, result);
+        updatePlanar(result);
+    }
+
+    uint8_t retrieveNewQuantizedColor(int tone, float offset, float intervalLength) {
         auto index = floor((tone - offset) / intervalLength);
         auto lowerBound = offset + intervalLength * index;
         auto upperBound = lowerBound + intervalLength;
@@ -306,23 +570,104 @@ private:
     }
 
     void updateImage(QImage target) {
-        QPixmap newPixmap = QPixmap::fromImage(target);
-        updateImage(newPixmap);
+        if(target.size() != current.size())
+            roi = QRect();
+        current = target;
+        planar = PlanarImage();
+        if(image == nullptr)
+            return;
+        TraceScope scope("upload", "upload");
+        if(tiled)
+            image->setPreview(target, QSize(tiled->width(), tiled->height()));
+        else
+            image->setImage(target);
+    }
+
+    // Palette ops work on colour pixels, so a grayscale image is widened to
+    // RGB32 first. The viewport picks up the new format on the next upload.
+    void expandGrayscale() {
+        if(currentImage().format() != QImage::Format_Grayscale8)
+            return;
+        current = current.convertToFormat(QImage::Format_RGB32);
+        planar = PlanarImage();
+    }
+
+    void updateRegion(QRect dirty) {
+        planar = PlanarImage();
+        if(image == nullptr)
+            return;
+        TraceScope scope("upload", "upload");
+        image->setImage(current, dirty);
     }
 
-    void updateImage(QPixmap target) {
-        window->setFixedSize(target.width(), target.height());
-        image->setFixedSize(target.width(), target.height());
-        image->setPixmap(target);
+    void displayPreview(QImage preview, QSize fullSize) {
+        image->setPreview(preview, fullSize);
     }
 
     QImage onPixels(std::function<void(ImageData)> action) {
-        auto convertedImage = image->pixmap().toImage();
-        return onPixels(convertedImage, action);
+        return onPixels(currentImage(), action);
+    }
+
+    void applyPixels(std::function<void(ImageData)> action) {
+        if(tiled) {
+            TraceScope scope("mapTiles");
+            if(!tiled->mapTiles([this, action](QImage tile) {
+                return onPixels(tile, action);
+            }))
+                qWarning("Editing the tiled image failed; some tiles may be unchanged");
+            updateImage(tiled->preview());
+            return;
+        }
+        if(!roi.isEmpty()) {
+            onPixels(currentImage(), roi, action);
+            updateRegion(roi);
+            return;
+        }
+        updateImage(onPixels(action));
+    }
+
+    void applyChannelLookup(const ChannelLookup &lookup) {
+        if(tiled) {
+            TraceScope scope("mapTiles");
+            if(!tiled->mapTiles([&lookup](QImage tile) {
+                applyLookup(tile, tile.rect(), lookup);
+                return tile;
+            }))
+                qWarning("Editing the tiled image failed; some tiles may be unchanged");
+            updateImage(tiled->preview());
+            return;
+        }
+        TraceScope scope("lookup");
+        if(!roi.isEmpty()) {
+            applyLookup(currentImage(), roi, lookup);
+            updateRegion(roi);
+            return;
+        }
+        auto result = BufferPool::instance().copy(currentImage());
+        applyLookup(result, result.rect(), lookup);
+        updateImage(result);
+    }
+
+    void onPixels(QImage &target, QRect rect, std::function<void(ImageData)> action) {
+        TraceScope scope("onPixels");
+        ImageData imageData;
+        imageData.width = target.width();
+        imageData.height = target.height();
+        imageData.size = imageData.width * imageData.height;
+        imageData.pixels = (QRgb*) target.bits();
+        for(int row = rect.top(); row <= rect.bottom(); row++) {
+            for(int column = rect.left(); column <= rect.right(); column++) {
+                imageData.index = row * imageData.width + column;
+                imageData.columnIndex = column;
+                imageData.rowIndex = row;
+                action(imageData);
+            }
+        }
     }
 
     QImage onPixels(QImage base, std::function<void(ImageData)> action) {
-        auto convertedImage = base;
+        TraceScope scope("onPixels");
+        auto convertedImage = BufferPool::instance().copy(base);
         auto height = convertedImage.height();
         auto width = convertedImage.width();
         auto size = width * height;
@@ -348,113 +693,62 @@ private:
         return value;
     }
 
-    QImage grayscale(QImage target) {
-        return onPixels(target, [](ImageData data) {
-            auto pixelValue = data.pixels[data.index];
-            int luminance = qRed(pixelValue) * 0.299 + qGreen(pixelValue) * 0.587 + qBlue(pixelValue) * 0.114;
-            data.pixels[data.index] = QColor(luminance, luminance, luminance).rgb();
-        });
-    }
-
-    uint32_t *calculateHistogram() {
-        return calculateHistogram(image->pixmap().toImage());
-    }
-
-    uint32_t *calculateHistogram(QImage target) {
-        QImage grayscaled = grayscale(target);
-        const int pixelSize = 256;
-        uint32_t *counts = new uint32_t[pixelSize]();
-        onPixels(grayscaled, [counts](ImageData data) {
-            counts[qRed(data.pixels[data.index])]++;
-        });
-        return counts;
-    }
-
-    uint32_t *calculateNormalizedHistogram(QImage target) {
-        float factor = 255.0 / (target.size().width() * target.size().height());
-        return calculateNormalizedHistogram(target, factor);
+    static void grayscalePixel(ImageData data) {
+        auto pixelValue = data.pixels[data.index];
+        int luminance = qRed(pixelValue) * 0.299 + qGreen(pixelValue) * 0.587 + qBlue(pixelValue) * 0.114;
+        data.pixels[data.index] = QColor(luminance, luminance, luminance).rgb();
     }
 
-    uint32_t *calculateNormalizedHistogram(QImage target, double factor) {
-        auto histogram = calculateHistogram(target);
-        uint32_t *cumulativeHistogram = new uint32_t[256];
-        cumulativeHistogram[0] = factor * histogram[0];
-        for(int i = 1; i < 256; i++)
-            cumulativeHistogram[i] = cumulativeHistogram[i - 1] + factor * histogram[i];
-        return cumulativeHistogram;
-    }
-
-    uint32_t *calculateNormalizedHistogram() {
-        return calculateNormalizedHistogram(image->pixmap().toImage());
+    ChannelStatistics luminanceStatistics() {
+        if(tiled) {
+            ChannelStatistics result;
+            QMutex mutex;
+            tiled->forEachTile([&result, &mutex](QImage tile) {
+                auto partial = imageStatistics(tile, tile.rect());
+                QMutexLocker locker(&mutex);
+                result.add(partial.luminance);
+            });
+            return result;
+        }
+        ChannelStatistics result;
+        luminanceHistogramPlanar(planarImage(), result.counts);
+        result.total = pixelCount();
+        return result;
     }
 
-    void showHistogram(QString title, QImage image) {
-        auto height = image.height();
-        auto width = image.width();
-        auto size = width * height;
-        int min = size, max = 0;
-        const int pixelSize = 256;
-        QBarSet *sets[pixelSize] = {};
-        QStringList categories;
-        auto counts = calculateHistogram(image);
-        for(int i = 0; i < pixelSize; i++) {
-            categories << QString::number(i);
-            sets[i] = new QBarSet(QString::number(i));
-            QList list = QList<qreal>(256, 0);
-            list.insert(i, counts[i]);
-            sets[i]->append(list);
-            if(counts[i] > max)
-                max = counts[i];
-            if(counts[i] < min)
-                min = counts[i];
-        }
-        QWidget *window = new QWidget;
-        QGridLayout *layout = new QGridLayout;
-        window->setLayout(layout);
-        QChart *chart = new QChart();
-        chart->setTitle(title);
-        chart->setAnimationOptions(QChart::SeriesAnimations);
-        QStackedBarSeries *series = new QStackedBarSeries();
-        chart->addSeries(series);
-        for(int i = 0; i < pixelSize; i++)
-            series->append(sets[i]);
-        QValueAxis *axisX = new QValueAxis();
-        axisX->setRange(0, pixelSize - 1);
-        chart->addAxis(axisX, Qt::AlignBottom);
-        series->attachAxis(axisX);
-        QValueAxis *axisY = new QValueAxis();
-        axisY->setRange(min, max);
-        chart->addAxis(axisY, Qt::AlignLeft);
-        series->attachAxis(axisY);
-        QChartView *chartView = new QChartView(chart);
-        chartView->setRenderHint(QPainter::Antialiasing);
-        chart->legend()->setVisible(false);
-        layout->addWidget(chartView, 0, 0);
-        window->setMinimumSize(720, 480);
-        window->show();
-        delete counts;
+    // Luminance of the selection when there is one, so region operations
+    // follow the region's own distribution.
+    ChannelStatistics regionLuminanceStatistics() {
+        if(tiled || roi.isEmpty())
+            return luminanceStatistics();
+        return imageStatistics(currentImage(), roi).luminance;
     }
 
-    int findClosestShade(uint32_t *sourceHistogram, uint32_t *targetHistogram, int shade) {
-        int minShade = shade, minDiff = abs((int) targetHistogram[shade] - (int) sourceHistogram[shade]);
-        for(int i = 0; i < 256; i++) {
-            auto diff = abs((int) targetHistogram[i] - (int) sourceHistogram[shade]);
-            if(diff < minDiff) {
-                minShade = i;
-                minDiff = diff;
-            }
-        }
-        return minShade;
+    static std::function<void(QString, const ChannelStatistics&)> &histogramViewer() {
+        static std::function<void(QString, const ChannelStatistics&)> viewer;
+        return viewer;
     }
 
-    QRgb average(QList<QRgb> values) {
-        int red = 0, green = 0, blue = 0;
-        for(QRgb value : values) {
-            red += qRed(value);
-            green += qGreen(value);
-            blue += qBlue(value);
+    void showHistogram(QString title, const ChannelStatistics &statistics) {
+        if(image == nullptr || !histogramViewer())
+            return;
+        histogramViewer()(title, statistics);
+    }
+
+    ChannelHistograms sourceHistograms() {
+        if(tiled) {
+            ChannelHistograms result;
+            QMutex mutex;
+            tiled->forEachTile([&result, &mutex](QImage tile) {
+                auto partial = channelHistograms(tile);
+                QMutexLocker locker(&mutex);
+                result.add(partial);
+            });
+            return result;
         }
-        return QColor(red / values.length(), green / values.length(), blue / values.length()).rgb();
+        if(!roi.isEmpty())
+            return channelHistograms(BufferPool::instance().copy(currentImage(), roi));
+        return channelHistograms(currentImage());
     }
 
     void flip(double kernel[3][3]) {
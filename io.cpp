@@ -1,7 +1,138 @@
 #include "io.h"
+#include "image_cache.h"
+#include "raw_image.h"
 
-Image load(std::string file_name) {
-    auto result = Image();
-    result.pixels = stbi_load(file_name.c_str(), &result.width, &result.height, &result.channels, DEFAULT_CHANNEL_COUNT);
-    return result;
+#include <QFileInfo>
+#include <QImageReader>
+#include <QList>
+#include <QReadWriteLock>
+#include <QtConcurrent/QtConcurrent>
+
+// Decoders are looked up from pool threads while the GUI may register new
+// ones, so the list is guarded. Registered decoders are never removed.
+static QReadWriteLock decodersLock;
+
+static QList<ImageDecoder*> &decoders() {
+    static QList<ImageDecoder*> registered = {new RawDecoder, new JpegDecoder, new GenericDecoder};
+    return registered;
+}
+
+void registerDecoder(ImageDecoder *decoder) {
+    QWriteLocker locker(&decodersLock);
+    decoders().prepend(decoder);
+}
+
+ImageDecoder *decoderFor(QString path) {
+    QReadLocker locker(&decodersLock);
+    for(auto decoder : decoders())
+        if(decoder->canDecode(path))
+            return decoder;
+    return nullptr;
+}
+
+// The kernels read pixels as QRgb (0xAARRGGBB, not premultiplied), so any
+// other 32-bit layout, such as RGBA8888 or ARGB32_Premultiplied, is
+// converted too.
+static QImage toWorkingFormat(QImage image) {
+    if(image.isNull() || image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32)
+        return image;
+    return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+}
+
+bool JpegDecoder::canDecode(QString path) {
+    return QImageReader::imageFormat(path) == "jpeg";
+}
+
+bool JpegDecoder::supportsScaledDecode() {
+    return true;
+}
+
+QSize JpegDecoder::size(QString path) {
+    return QImageReader(path).size();
+}
+
+QImage JpegDecoder::decode(QString path, int scaleDenominator) {
+    QImageReader reader(path, "jpeg");
+    auto size = reader.size();
+    if(scaleDenominator > 1 && size.isValid())
+        reader.setScaledSize(QSize((size.width() + scaleDenominator - 1) / scaleDenominator, (size.height() + scaleDenominator - 1) / scaleDenominator));
+    return toWorkingFormat(reader.read());
+}
+
+bool RawDecoder::canDecode(QString path) {
+    return RawImage::isRawImage(path);
+}
+
+bool RawDecoder::supportsScaledDecode() {
+    return false;
+}
+
+QSize RawDecoder::size(QString path) {
+    return RawImage::size(path);
+}
+
+// Grayscale8 is kept as mapped, since the operations handle it natively;
+// every other layout a raw header may declare goes to the working format.
+QImage RawDecoder::decode(QString path, int scaleDenominator) {
+    auto image = RawImage::load(path);
+    if(image.format() != QImage::Format_Grayscale8)
+        image = toWorkingFormat(image);
+    if(scaleDenominator > 1)
+        return image.scaled(image.size() / scaleDenominator);
+    return image;
+}
+
+bool GenericDecoder::canDecode(QString path) {
+    return !QImageReader::imageFormat(path).isEmpty();
+}
+
+bool GenericDecoder::supportsScaledDecode() {
+    return false;
+}
+
+QSize GenericDecoder::size(QString path) {
+    return QImageReader(path).size();
+}
+
+QImage GenericDecoder::decode(QString path, int scaleDenominator) {
+    auto image = toWorkingFormat(QImageReader(path).read());
+    if(scaleDenominator > 1)
+        return image.scaled(image.size() / scaleDenominator);
+    return image;
+}
+
+int previewScaleDenominator(QSize size) {
+    auto longestSide = std::max(size.width(), size.height());
+    for(int denominator = 8; denominator > 1; denominator /= 2)
+        if(longestSide / denominator >= PREVIEW_DECODE_SIZE)
+            return denominator;
+    return 1;
+}
+
+QImage decodeImageUncached(QString path, int scaleDenominator) {
+    auto decoder = decoderFor(path);
+    if(decoder == nullptr)
+        return QImage();
+    return decoder->decode(path, scaleDenominator);
+}
+
+QImage decodeImage(QString path, int scaleDenominator) {
+    return ImageCache::instance().decode(path, scaleDenominator);
+}
+
+QFuture<QImage> decodeImageAsync(QString path, int scaleDenominator) {
+    return ImageCache::instance().decodeAsync(path, scaleDenominator);
+}
+
+void prefetchImage(QString path) {
+    auto decoder = decoderFor(path);
+    if(decoder == nullptr)
+        return;
+    auto size = decoder->size(path);
+    if(!size.isValid() || (qint64) size.width() * size.height() > TILED_PIXEL_THRESHOLD)
+        return;
+    auto denominator = previewScaleDenominator(size);
+    if(denominator > 1 && decoder->supportsScaledDecode())
+        decodeImageAsync(path, denominator);
+    decodeImageAsync(path);
 }
@@ -3,11 +3,58 @@
 
 #include "definitions.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include <QFuture>
+#include <QImage>
+#include <QString>
 
-#include <string>
+class ImageDecoder {
+public:
+    virtual ~ImageDecoder() = default;
 
-Image load(std::string file_name);
+    virtual bool canDecode(QString path) = 0;
+    virtual bool supportsScaledDecode() = 0;
+    virtual QSize size(QString path) = 0;
+    virtual QImage decode(QString path, int scaleDenominator) = 0;
+};
+
+// JPEG decoding through QImageReader with a scaled size, which the Qt JPEG
+// handler turns into libjpeg DCT scaling (1/2, 1/4 or 1/8) instead of a full
+// decode followed by a resize.
+class JpegDecoder : public ImageDecoder {
+public:
+    bool canDecode(QString path) override;
+    bool supportsScaledDecode() override;
+    QSize size(QString path) override;
+    QImage decode(QString path, int scaleDenominator) override;
+};
+
+class RawDecoder : public ImageDecoder {
+public:
+    bool canDecode(QString path) override;
+    bool supportsScaledDecode() override;
+    QSize size(QString path) override;
+    QImage decode(QString path, int scaleDenominator) override;
+};
+
+class GenericDecoder : public ImageDecoder {
+public:
+    bool canDecode(QString path) override;
+    bool supportsScaledDecode() override;
+    QSize size(QString path) override;
+    QImage decode(QString path, int scaleDenominator) override;
+};
+
+void registerDecoder(ImageDecoder *decoder);
+ImageDecoder *decoderFor(QString path);
+
+int previewScaleDenominator(QSize size);
+// decodeImage and decodeImageAsync go through the shared ImageCache.
+QImage decodeImageUncached(QString path, int scaleDenominator = 1);
+QImage decodeImage(QString path, int scaleDenominator = 1);
+QFuture<QImage> decodeImageAsync(QString path, int scaleDenominator = 1);
+// Starts decoding the preview and the full image in the background, so
+// windows built afterwards find both in flight in the ImageCache. Images
+// large enough to be tiled are left to TiledImage.
+void prefetchImage(QString path);
 
 #endif // IO_H
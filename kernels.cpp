@@ -0,0 +1,67 @@
+#include "kernels.h"
+
+#include <QByteArray>
+#include <QtGlobal>
+
+IsaLevel supportedIsaLevel() {
+#ifdef FPI_MULTI_ISA
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        return IsaLevel::Avx512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return IsaLevel::Avx2;
+    if(__builtin_cpu_supports("sse4.2"))
+        return IsaLevel::Sse42;
+#endif
+    return IsaLevel::Baseline;
+}
+
+const char *isaLevelName(IsaLevel level) {
+    switch(level) {
+    case IsaLevel::Sse42:
+        return "sse4.2";
+    case IsaLevel::Avx2:
+        return "avx2";
+    case IsaLevel::Avx512:
+        return "avx512";
+    default:
+        return "baseline";
+    }
+}
+
+static IsaLevel requestedIsaLevel(IsaLevel supported) {
+    auto requested = qgetenv("FPI_ISA").toLower();
+    if(requested.isEmpty())
+        return supported;
+    for(auto level : {IsaLevel::Baseline, IsaLevel::Sse42, IsaLevel::Avx2, IsaLevel::Avx512}) {
+        if(requested != isaLevelName(level))
+            continue;
+        if(level > supported) {
+            qWarning("FPI_ISA=%s is not supported by this CPU, using %s", requested.constData(), isaLevelName(supported));
+            return supported;
+        }
+        return level;
+    }
+    qWarning("Unknown FPI_ISA=%s, using %s", requested.constData(), isaLevelName(supported));
+    return supported;
+}
+
+static const KernelTable &selectKernels() {
+    switch(requestedIsaLevel(supportedIsaLevel())) {
+#ifdef FPI_MULTI_ISA
+    case IsaLevel::Avx512:
+        return avx512Kernels();
+    case IsaLevel::Avx2:
+        return avx2Kernels();
+    case IsaLevel::Sse42:
+        return sse42Kernels();
+#endif
+    default:
+        return baselineKernels();
+    }
+}
+
+const KernelTable &kernels() {
+    static const KernelTable &selected = selectKernels();
+    return selected;
+}
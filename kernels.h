@@ -0,0 +1,68 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "definitions.h"
+
+#include <cstddef>
+
+enum class IsaLevel {
+    Baseline,
+    Sse42,
+    Avx2,
+    Avx512
+};
+
+// Per-channel 8-bit lookup table for point operations.
+struct ChannelLookup {
+    BYTE table[DEFAULT_CHANNEL_COUNT][256];
+};
+
+// Row kernels shared by the planar and interleaved code paths. The same
+// source (kernels_impl.h) is compiled once per ISA level and the best level
+// the CPU supports is picked on first use. FPI_ISA=baseline|sse4.2|avx2|avx512
+// forces a lower level for testing and benchmarking.
+struct KernelTable {
+    IsaLevel level;
+    const char *name;
+
+    void (*deinterleaveRow)(const std::uint32_t *pixels, BYTE *red, BYTE *green, BYTE *blue, int width);
+    void (*interleaveRow)(const BYTE *red, const BYTE *green, const BYTE *blue, std::uint32_t *pixels, int width);
+    void (*convolveRow)(const BYTE *above, const BYTE *center, const BYTE *below, BYTE *out, int width, const float weights[9], float increment);
+    void (*averageRows)(const BYTE *first, const BYTE *second, BYTE *out, int width);
+    void (*upsampleRow)(const BYTE *in, BYTE *out, int width);
+    void (*luminanceRow)(const BYTE *red, const BYTE *green, const BYTE *blue, BYTE *out, int width);
+    void (*lookupRow)(std::uint32_t *pixels, int width, const BYTE table[DEFAULT_CHANNEL_COUNT][256]);
+    void (*paletteRow)(std::uint32_t *pixels, int width, const BYTE *cache, const std::uint32_t *colors);
+    void (*claheRow)(std::uint32_t *pixels, int width, const BYTE *top, const BYTE *bottom,
+                     const std::int32_t *left, const std::int32_t *right, const std::uint16_t *weights, int weight);
+    void (*transposeBlock)(const std::uint32_t *source, std::ptrdiff_t sourceStride, std::uint32_t *target,
+                           std::ptrdiff_t targetRowStep, std::ptrdiff_t targetColumnStep, int width, int height);
+
+    // Single-channel variants for Format_Grayscale8 images.
+    void (*grayscaleRow)(const std::uint32_t *pixels, BYTE *out, int width);
+    void (*lookupGrayRow)(BYTE *pixels, int width, const BYTE table[256]);
+    void (*claheGrayRow)(BYTE *pixels, int width, const BYTE *top, const BYTE *bottom,
+                         const std::int32_t *left, const std::int32_t *right, const std::uint16_t *weights, int weight);
+    void (*transposeGrayBlock)(const BYTE *source, std::ptrdiff_t sourceStride, BYTE *target,
+                               std::ptrdiff_t targetRowStep, std::ptrdiff_t targetColumnStep, int width, int height);
+
+    // Image comparison: squared error of two rows, the five SSIM column sums
+    // (x, y, x^2, y^2, xy) sliding by one row, and SSIM across a row of
+    // windows.
+    std::uint64_t (*squaredErrorRow)(const BYTE *first, const BYTE *second, int width);
+    void (*ssimColumnsRow)(const BYTE *first, const BYTE *second, std::uint32_t *columns, std::ptrdiff_t columnStride, int width, bool remove);
+    void (*ssimRow)(const std::uint32_t *columns, std::ptrdiff_t columnStride, float *scores, int count, int window, float c1, float c2);
+};
+
+const KernelTable &kernels();
+IsaLevel supportedIsaLevel();
+const char *isaLevelName(IsaLevel level);
+
+const KernelTable &baselineKernels();
+#ifdef FPI_MULTI_ISA
+const KernelTable &sse42Kernels();
+const KernelTable &avx2Kernels();
+const KernelTable &avx512Kernels();
+#endif
+
+#endif // KERNELS_H
@@ -0,0 +1,6 @@
+#include "kernels.h"
+
+#define KERNEL_TABLE avx2Kernels
+#define KERNEL_LEVEL IsaLevel::Avx2
+#define KERNEL_NAME "avx2"
+#include "kernels_impl.h"
@@ -0,0 +1,6 @@
+#include "kernels.h"
+
+#define KERNEL_TABLE avx512Kernels
+#define KERNEL_LEVEL IsaLevel::Avx512
+#define KERNEL_NAME "avx512"
+#include "kernels_impl.h"
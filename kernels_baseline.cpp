@@ -0,0 +1,6 @@
+#include "kernels.h"
+
+#define KERNEL_TABLE baselineKernels
+#define KERNEL_LEVEL IsaLevel::Baseline
+#define KERNEL_NAME "baseline"
+#include "kernels_impl.h"
@@ -0,0 +1,219 @@
+// Included once per ISA level by kernels_<level>.cpp with KERNEL_TABLE,
+// KERNEL_LEVEL and KERNEL_NAME defined. Each of those files is compiled
+// with its own -m flags, so this file must only define functions with
+// internal linkage: an inline function shared with the rest of the program
+// could be merged with the wider build and run on a CPU without it.
+
+namespace {
+
+void deinterleaveRow(const std::uint32_t *__restrict pixels, BYTE *__restrict red, BYTE *__restrict green, BYTE *__restrict blue, int width) {
+    for(int x = 0; x < width; x++) {
+        red[x] = pixels[x] >> 16;
+        green[x] = pixels[x] >> 8;
+        blue[x] = pixels[x];
+    }
+}
+
+void interleaveRow(const BYTE *__restrict red, const BYTE *__restrict green, const BYTE *__restrict blue, std::uint32_t *__restrict pixels, int width) {
+    for(int x = 0; x < width; x++)
+        pixels[x] = 0xff000000u | ((std::uint32_t) red[x] << 16) | ((std::uint32_t) green[x] << 8) | blue[x];
+}
+
+void convolveRow(const BYTE *__restrict above, const BYTE *__restrict center, const BYTE *__restrict below, BYTE *__restrict out, int width, const float weights[9], float increment) {
+    const float w0 = weights[0], w1 = weights[1], w2 = weights[2];
+    const float w3 = weights[3], w4 = weights[4], w5 = weights[5];
+    const float w6 = weights[6], w7 = weights[7], w8 = weights[8];
+    for(int x = 1; x < width - 1; x++) {
+        float sum = w0 * above[x - 1] + w1 * above[x] + w2 * above[x + 1]
+                    + w3 * center[x - 1] + w4 * center[x] + w5 * center[x + 1]
+                    + w6 * below[x - 1] + w7 * below[x] + w8 * below[x + 1];
+        float value = (float) (int) sum + increment;
+        value = value < 0.0f ? 0.0f : value;
+        value = value > 255.0f ? 255.0f : value;
+        out[x] = (BYTE) (int) value;
+    }
+}
+
+void averageRows(const BYTE *__restrict first, const BYTE *__restrict second, BYTE *__restrict out, int width) {
+    for(int x = 0; x < width; x++)
+        out[x] = (first[x] + second[x]) >> 1;
+}
+
+void upsampleRow(const BYTE *__restrict in, BYTE *__restrict out, int width) {
+    for(int x = 0; x + 1 < width; x++) {
+        out[x * 2] = in[x];
+        out[x * 2 + 1] = (in[x] + in[x + 1]) >> 1;
+    }
+    if(width > 0)
+        out[(width - 1) * 2] = in[width - 1];
+}
+
+void luminanceRow(const BYTE *__restrict red, const BYTE *__restrict green, const BYTE *__restrict blue, BYTE *__restrict out, int width) {
+    for(int x = 0; x < width; x++)
+        out[x] = (BYTE) (int) (red[x] * 0.299 + green[x] * 0.587 + blue[x] * 0.114);
+}
+
+void lookupRow(std::uint32_t *__restrict pixels, int width, const BYTE table[DEFAULT_CHANNEL_COUNT][256]) {
+    for(int x = 0; x < width; x++) {
+        auto pixel = pixels[x];
+        pixels[x] = (pixel & 0xff000000u) | ((std::uint32_t) table[0][(pixel >> 16) & 0xff] << 16)
+                    | ((std::uint32_t) table[1][(pixel >> 8) & 0xff] << 8) | table[2][pixel & 0xff];
+    }
+}
+
+// Palette caches are indexed by the top five bits of each channel.
+std::uint32_t paletteCell(std::uint32_t pixel) {
+    return ((pixel >> 9) & 0x7c00u) | ((pixel >> 6) & 0x03e0u) | ((pixel >> 3) & 0x001fu);
+}
+
+void paletteRow(std::uint32_t *__restrict pixels, int width, const BYTE *__restrict cache, const std::uint32_t *__restrict colors) {
+    for(int x = 0; x < width; x++)
+        pixels[x] = (pixels[x] & 0xff000000u) | (colors[cache[paletteCell(pixels[x])]] & 0x00ffffffu);
+}
+
+// Blends four tile lookup tables: top/bottom select the tile rows,
+// left/right the table offsets within them, weights are 8-bit fixed point.
+std::uint32_t claheChannel(std::uint32_t value, const BYTE *top, const BYTE *bottom, std::int32_t left, std::int32_t right,
+                           std::uint32_t weight, std::uint32_t verticalWeight) {
+    std::uint32_t upper = top[left + value] * (256 - weight) + top[right + value] * weight;
+    std::uint32_t lower = bottom[left + value] * (256 - weight) + bottom[right + value] * weight;
+    return (upper * (256 - verticalWeight) + lower * verticalWeight + 32768) >> 16;
+}
+
+void claheRow(std::uint32_t *__restrict pixels, int width, const BYTE *__restrict top, const BYTE *__restrict bottom,
+              const std::int32_t *__restrict left, const std::int32_t *__restrict right, const std::uint16_t *__restrict weights, int weight) {
+    for(int x = 0; x < width; x++) {
+        auto pixel = pixels[x];
+        auto red = claheChannel((pixel >> 16) & 0xff, top, bottom, left[x], right[x], weights[x], weight);
+        auto green = claheChannel((pixel >> 8) & 0xff, top, bottom, left[x], right[x], weights[x], weight);
+        auto blue = claheChannel(pixel & 0xff, top, bottom, left[x], right[x], weights[x], weight);
+        pixels[x] = (pixel & 0xff000000u) | (red << 16) | (green << 8) | blue;
+    }
+}
+
+template<typename Pixel>
+void transpose(const Pixel *source, std::ptrdiff_t sourceStride, Pixel *target,
+               std::ptrdiff_t targetRowStep, std::ptrdiff_t targetColumnStep, int width, int height) {
+    const int block = 16;
+    for(int top = 0; top < height; top += block) {
+        int bottom = top + block < height ? top + block : height;
+        for(int left = 0; left < width; left += block) {
+            int right = left + block < width ? left + block : width;
+            for(int y = top; y < bottom; y++) {
+                auto in = source + y * sourceStride;
+                auto out = target + y * targetColumnStep;
+                for(int x = left; x < right; x++)
+                    out[x * targetRowStep] = in[x];
+            }
+        }
+    }
+}
+
+void transposeBlock(const std::uint32_t *source, std::ptrdiff_t sourceStride, std::uint32_t *target,
+                    std::ptrdiff_t targetRowStep, std::ptrdiff_t targetColumnStep, int width, int height) {
+    transpose(source, sourceStride, target, targetRowStep, targetColumnStep, width, height);
+}
+
+void grayscaleRow(const std::uint32_t *__restrict pixels, BYTE *__restrict out, int width) {
+    for(int x = 0; x < width; x++)
+        out[x] = (BYTE) (int) (((pixels[x] >> 16) & 0xff) * 0.299 + ((pixels[x] >> 8) & 0xff) * 0.587 + (pixels[x] & 0xff) * 0.114);
+}
+
+void lookupGrayRow(BYTE *__restrict pixels, int width, const BYTE *__restrict table) {
+    for(int x = 0; x < width; x++)
+        pixels[x] = table[pixels[x]];
+}
+
+void claheGrayRow(BYTE *__restrict pixels, int width, const BYTE *__restrict top, const BYTE *__restrict bottom,
+                  const std::int32_t *__restrict left, const std::int32_t *__restrict right, const std::uint16_t *__restrict weights, int weight) {
+    for(int x = 0; x < width; x++)
+        pixels[x] = claheChannel(pixels[x], top, bottom, left[x], right[x], weights[x], weight);
+}
+
+void transposeGrayBlock(const BYTE *source, std::ptrdiff_t sourceStride, BYTE *target,
+                        std::ptrdiff_t targetRowStep, std::ptrdiff_t targetColumnStep, int width, int height) {
+    transpose(source, sourceStride, target, targetRowStep, targetColumnStep, width, height);
+}
+
+std::uint64_t squaredErrorRow(const BYTE *__restrict first, const BYTE *__restrict second, int width) {
+    std::uint64_t sum = 0;
+    for(int x = 0; x < width; x++) {
+        int difference = first[x] - second[x];
+        sum += (std::uint32_t) (difference * difference);
+    }
+    return sum;
+}
+
+void slideSsimColumns(const BYTE *__restrict first, const BYTE *__restrict second, std::uint32_t *__restrict sumA, std::uint32_t *__restrict sumB,
+                      std::uint32_t *__restrict squareA, std::uint32_t *__restrict squareB, std::uint32_t *__restrict product, int width, std::uint32_t sign) {
+    for(int x = 0; x < width; x++) {
+        std::uint32_t a = first[x], b = second[x];
+        sumA[x] += sign * a;
+        sumB[x] += sign * b;
+        squareA[x] += sign * (a * a);
+        squareB[x] += sign * (b * b);
+        product[x] += sign * (a * b);
+    }
+}
+
+// columns holds five rows of width sums, columnStride apart: x, y, x^2, y^2
+// and xy. Removal adds the row times 2^32 - 1, which wraps to subtraction.
+void ssimColumnsRow(const BYTE *first, const BYTE *second, std::uint32_t *columns, std::ptrdiff_t columnStride, int width, bool remove) {
+    slideSsimColumns(first, second, columns, columns + columnStride, columns + 2 * columnStride, columns + 3 * columnStride, columns + 4 * columnStride,
+                     width, remove ? (std::uint32_t) -1 : 1);
+}
+
+// SSIM of the window-wide spans of the column sums starting at every x in
+// [0, count). Spans are summed a chunk at a time with the offset as the outer
+// loop, so every addition runs across x.
+void ssimRow(const std::uint32_t *__restrict columns, std::ptrdiff_t columnStride, float *__restrict scores, int count, int window, float c1, float c2) {
+    const int chunk = 256;
+    std::uint32_t spans[5][chunk];
+    const float scale = 1.0f / (window * window);
+    for(int begin = 0; begin < count; begin += chunk) {
+        int length = count - begin < chunk ? count - begin : chunk;
+        for(int k = 0; k < 5; k++) {
+            auto column = columns + k * columnStride + begin;
+            auto span = spans[k];
+            for(int x = 0; x < length; x++)
+                span[x] = column[x];
+            for(int offset = 1; offset < window; offset++)
+                for(int x = 0; x < length; x++)
+                    span[x] += column[x + offset];
+        }
+        for(int x = 0; x < length; x++) {
+            float meanA = spans[0][x] * scale, meanB = spans[1][x] * scale;
+            float varianceA = spans[2][x] * scale - meanA * meanA;
+            float varianceB = spans[3][x] * scale - meanB * meanB;
+            float covariance = spans[4][x] * scale - meanA * meanB;
+            scores[begin + x] = ((2 * meanA * meanB + c1) * (2 * covariance + c2)) / ((meanA * meanA + meanB * meanB + c1) * (varianceA + varianceB + c2));
+        }
+    }
+}
+
+} // namespace
+
+const KernelTable &KERNEL_TABLE() {
+    static const KernelTable table = {
+        KERNEL_LEVEL,
+        KERNEL_NAME,
+        deinterleaveRow,
+        interleaveRow,
+        convolveRow,
+        averageRows,
+        upsampleRow,
+        luminanceRow,
+        lookupRow,
+        paletteRow,
+        claheRow,
+        transposeBlock,
+        grayscaleRow,
+        lookupGrayRow,
+        claheGrayRow,
+        transposeGrayBlock,
+        squaredErrorRow,
+        ssimColumnsRow,
+        ssimRow
+    };
+    return table;
+}
@@ -0,0 +1,6 @@
+#include "kernels.h"
+
+#define KERNEL_TABLE sse42Kernels
+#define KERNEL_LEVEL IsaLevel::Sse42
+#define KERNEL_NAME "sse4.2"
+#include "kernels_impl.h"
@@ -1,16 +1,41 @@
 #include "mainwindow.h"
+#include "sequence_command.h"
 
 #include <QApplication>
+#include <QCoreApplication>
+#include <QImageReader>
+#include <QTimer>
 #include <iostream>
 
 int main(int argc, char *argv[])
 {
+    // Starts the trace clock, which timeToFirstPixel is measured against.
+    Trace::instance();
+    // FPI1 --sequence ...: batch processing without any window, so it also
+    // runs where no display is available.
+    if(isSequenceCommand(argc, argv)) {
+        QCoreApplication application(argc, argv);
+        QImageReader::setAllocationLimit(0);
+        return runSequenceCommand(application.arguments());
+    }
     QApplication a(argc, argv);
+    QImageReader::setAllocationLimit(0);
+    // FPI1 [image]: with a path the decode starts before any widget exists,
+    // otherwise the file dialog opens once the controls are on screen.
+    auto imagePath = a.arguments().value(1);
+    if(!imagePath.isEmpty())
+        prefetchImage(imagePath);
     MainWindow w;
-    if(!w.requestImage()) {
-        a.exit();
-        return 0;
-    }
     w.show();
+    QTimer::singleShot(0, &w, [&w, imagePath]() {
+        if(imagePath.isEmpty() ? w.requestImage() : w.openImage(imagePath))
+            return;
+        if(imagePath.isEmpty()) {
+            QApplication::exit(0);
+            return;
+        }
+        std::cerr << "Cannot open " << imagePath.toStdString() << std::endl;
+        QApplication::exit(1);
+    });
     return a.exec();
 }
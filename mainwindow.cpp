@@ -1,39 +1,51 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
+#include "histogram_view.h"
 
 #include <QPixmap>
 #include <QFileDialog>
 #include <QCloseEvent>
+#include <QFutureWatcher>
 #include <QtConcurrent/QtConcurrent>
 
-const double GAUSSIAN[3][3] = {{0.0625, 0.125, 0.0625}, {0.125, 0.25, 0.125}, {0.0625, 0.125, 0.0625}};
-const double LAPLACIAN[3][3] = {{0, -1, 0}, {-1, 4, -1}, {0, -1, 0}};
-const double HIGH_PASS[3][3] = {{-1, -1, -1}, {-1, 8, -1}, {-1, -1, -1}};
-const double PREWITT_HX[3][3] = {{-1, 0, 1}, {-1, 0, 1}, {-1, 0, 1}};
-const double PREWITT_HY[3][3] = {{-1, -1, -1}, {0, 0, 0}, {1, 1, 1}};
-const double SOBEL_HX[3][3] = {{-1, 0, 1}, {-2, 0, 2}, {-1, 0, 1}};
-const double SOBEL_HY[3][3] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
-
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    ImageWidget::setHistogramViewer(showHistogramWindow);
+    Trace::instance().setListener([this](OperationSummary summary) {
+        QMetaObject::invokeMethod(this, [this, summary]() {
+            ui->statusbar->showMessage(summary.toString() + " | " + BufferPool::instance().statistics().toString()
+                                       + " | " + ImageCache::instance().statistics().toString());
+        }, Qt::QueuedConnection);
+    });
 }
 
 bool MainWindow::requestImage() {
-    auto file_name = QFileDialog::getOpenFileName(this, "Select image", ".", "Image files (*.jpg *.jpeg *.png *.bmp)");
+    auto file_name = QFileDialog::getOpenFileName(this, "Select image", ".", "Image files (*.jpg *.jpeg *.png *.bmp *.ppm *.fpiraw)");
     if(file_name.isNull() || file_name.isEmpty())
         return false;
+    return openImage(file_name);
+}
+
+bool MainWindow::openImage(QString file_name) {
+    if(decoderFor(file_name) == nullptr)
+        return false;
     original_image = ImageWidget::create("Original image", file_name);
-    processed_image = ImageWidget::create("Processed image", file_name);
+    processed_image = ImageWidget::create("Processed image (drag to select a region, right click to clear)", file_name);
+    processed_image->enableSelection();
     return true;
 }
 
 MainWindow::~MainWindow()
 {
+    ImageEncoder::pool()->waitForDone();
+    Trace::instance().setListener(nullptr);
+    Trace::instance().writeChromeTrace();
     delete original_image;
     delete processed_image;
+    delete difference_image;
     delete ui;
 }
 
@@ -67,12 +79,24 @@ void MainWindow::on_quantize_button_clicked()
     processed_image->quantize(ui->quantize_tones->value());
 }
 
+
+void MainWindow::on_quantizeColorsButton_clicked()
+{
+    processed_image->quantizeColors(ui->paletteColors->value());
+}
+
 void MainWindow::on_saveButton_clicked()
 {
-    auto fileName = QFileDialog::getSaveFileName(this, tr("Save Image File"), QString(), tr("Images (*.jpg)"));
+    auto fileName = QFileDialog::getSaveFileName(this, tr("Save Image File"), QString(), tr("JPEG (*.jpg *.jpeg);;PNG (*.png);;Portable pixmap (*.ppm);;Raw working image (*.fpiraw)"));
     if(fileName.isNull() || fileName.isEmpty())
         return;
-    processed_image->saveAsJPG(fileName);
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, fileName]() {
+        ui->statusbar->showMessage(watcher->result() ? tr("Saved %1").arg(fileName) : tr("Could not save %1").arg(fileName), 5000);
+        watcher->deleteLater();
+    });
+    ui->statusbar->showMessage(tr("Saving %1...").arg(fileName));
+    watcher->setFuture(processed_image->save(fileName, ImageEncoder::settingsFor(fileName, ui->saveQuality->value())));
 }
 
 
@@ -82,6 +106,12 @@ void MainWindow::on_histogramButton_clicked()
 }
 
 
+void MainWindow::on_statisticsButton_clicked()
+{
+    ui->statisticsLabel->setText(processed_image->statistics().toString());
+}
+
+
 void MainWindow::on_addBrightnessButton_clicked()
 {
     processed_image->addBrightness(ui->brightness->value());
@@ -100,18 +130,107 @@ void MainWindow::on_negativeButton_clicked()
 }
 
 
+void MainWindow::on_compareButton_clicked()
+{
+    auto reference = original_image->getImage();
+    showComparison(processed_image->compare(reference), processed_image->differenceHeatmap(reference));
+}
+
+
+void MainWindow::on_compareFilesButton_clicked()
+{
+    auto fileNames = QFileDialog::getOpenFileNames(this, tr("Select reference and test images"), QString(), tr("Image files (*.jpg *.jpeg *.png *.bmp *.ppm *.fpiraw)"));
+    if(fileNames.size() != 2)
+        return;
+    auto reference = decodeImage(fileNames[0]);
+    auto test = decodeImage(fileNames[1]);
+    showComparison(compareImages(reference, test), differenceHeatmap(reference, test));
+}
+
+
+void MainWindow::showComparison(ImageComparison comparison, QImage heatmap)
+{
+    ui->comparisonLabel->setText(comparison.toString());
+    delete difference_image;
+    difference_image = nullptr;
+    if(!heatmap.isNull())
+        difference_image = ImageWidget::create(QString("Difference (x%1)").arg(HEATMAP_DEFAULT_GAIN), heatmap);
+}
+
+
 void MainWindow::on_equalizeButton_clicked()
 {
     processed_image->equalize();
 }
 
 
+void MainWindow::on_claheButton_clicked()
+{
+    processed_image->equalizeAdaptive(ui->claheClipLimit->value());
+}
+
+
+void MainWindow::on_rankFilterButton_clicked()
+{
+    processed_image->rankFilter(ui->rankRadius->value(), ui->rankPercentile->value() / 100);
+}
+
+
+void MainWindow::on_boxBlurButton_clicked()
+{
+    processed_image->boxBlur(ui->boxRadius->value());
+}
+
+
+void MainWindow::on_gaussianBlurButton_clicked()
+{
+    processed_image->gaussianBlur(ui->gaussianSigma->value());
+}
+
+
+void MainWindow::on_morphologyButton_clicked()
+{
+    auto operation = (MorphologyOperation) ui->morphologyOperation->currentIndex();
+    processed_image->morphology(operation, ui->morphologyRadiusX->value(), ui->morphologyRadiusY->value());
+}
+
+
+void MainWindow::on_bilateralButton_clicked()
+{
+    processed_image->bilateral(ui->bilateralSpatialSigma->value(), ui->bilateralRangeSigma->value());
+}
+
+
 void MainWindow::on_matchHistogramButton_clicked()
 {
-    auto fileName = QFileDialog::getOpenFileName(this, tr("Open Image File"), QString(), tr("Image files (*.jpg *.jpeg *.png *.bmp)"));
+    auto fileName = QFileDialog::getOpenFileName(this, tr("Open Image File"), QString(), tr("Image files (*.jpg *.jpeg *.png *.bmp *.ppm *.fpiraw)"));
     if(fileName.isNull() || fileName.isEmpty())
         return;
-    processed_image->matchHistogram(QPixmap(fileName).toImage());
+    processed_image->matchHistogram(fileName);
+}
+
+
+void MainWindow::on_batchMatchButton_clicked()
+{
+    auto reference = QFileDialog::getOpenFileName(this, tr("Select Reference Image"), QString(), tr("Image files (*.jpg *.jpeg *.png *.bmp *.ppm *.fpiraw)"));
+    if(reference.isEmpty())
+        return;
+    auto files = QFileDialog::getOpenFileNames(this, tr("Select Images to Match"), QString(), tr("Image files (*.jpg *.jpeg *.png *.bmp *.ppm *.fpiraw)"));
+    if(files.isEmpty())
+        return;
+    auto outputDirectory = QFileDialog::getExistingDirectory(this, tr("Select Output Directory"));
+    if(outputDirectory.isEmpty())
+        return;
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::progressValueChanged, this, [this, watcher](int progress) {
+        ui->statusbar->showMessage(tr("Matching %1/%2...").arg(progress).arg(watcher->progressMaximum()));
+    });
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher]() {
+        auto results = watcher->future().results();
+        ui->statusbar->showMessage(tr("Matched %1 of %2 images").arg(results.count(true)).arg(results.size()), 5000);
+        watcher->deleteLater();
+    });
+    watcher->setFuture(matchHistogramBatch(files, reference, outputDirectory, ui->saveQuality->value()));
 }
 
 
@@ -19,6 +19,7 @@ public:
     ~MainWindow();
 
     bool requestImage();
+    bool openImage(QString path);
 
 private slots:
     void on_grayscale_button_clicked();
@@ -31,20 +32,42 @@ private slots:
 
     void on_quantize_button_clicked();
 
+    void on_quantizeColorsButton_clicked();
+
     void on_saveButton_clicked();
 
     void on_histogramButton_clicked();
 
+    void on_statisticsButton_clicked();
+
     void on_addBrightnessButton_clicked();
 
     void on_contrastButton_clicked();
 
     void on_negativeButton_clicked();
 
+    void on_compareButton_clicked();
+
+    void on_compareFilesButton_clicked();
+
     void on_equalizeButton_clicked();
 
+    void on_claheButton_clicked();
+
+    void on_rankFilterButton_clicked();
+
+    void on_boxBlurButton_clicked();
+
+    void on_gaussianBlurButton_clicked();
+
+    void on_morphologyButton_clicked();
+
+    void on_bilateralButton_clicked();
+
     void on_matchHistogramButton_clicked();
 
+    void on_batchMatchButton_clicked();
+
     void on_zoomOutButton_clicked();
 
     void on_zoomInButton_clicked();
@@ -58,7 +81,10 @@ private slots:
     void on_convolveButton_clicked();
 
 private:
+    void showComparison(ImageComparison comparison, QImage heatmap);
+
     ImageWidget *original_image = nullptr, *processed_image = nullptr;
+    ImageWidget *difference_image = nullptr;
     Ui::MainWindow *ui;
 };
 #endif // MAINWINDOW_H
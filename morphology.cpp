@@ -0,0 +1,156 @@
+#include "morphology.h"
+#include "parallel.h"
+
+#include <QThreadPool>
+
+#include <algorithm>
+#include <vector>
+
+// Rows the horizontal pass runs side by side, and columns per task of the
+// vertical pass.
+#define MORPHOLOGY_LANES 16
+#define MORPHOLOGY_STRIP 64
+
+struct Minimum {
+    static constexpr BYTE identity = 255;
+
+    static BYTE apply(BYTE a, BYTE b) {
+        return a < b ? a : b;
+    }
+};
+
+struct Maximum {
+    static constexpr BYTE identity = 0;
+
+    static BYTE apply(BYTE a, BYTE b) {
+        return a > b ? a : b;
+    }
+};
+
+// van Herk/Gil-Werman over count samples spaced stride apart, lanes
+// independent sequences side by side, in place. The line is padded by radius
+// identity samples on both ends and cut into blocks of 2 * radius + 1; each
+// window spans at most two blocks, so it is the backward running value at its
+// start combined with the forward running value at its end.
+template<typename Operation>
+static void vanHerkLine(BYTE *data, int count, std::ptrdiff_t stride, int lanes, int radius, std::vector<BYTE> &forward, std::vector<BYTE> &backward) {
+    static const std::vector<BYTE> outside(std::max(MORPHOLOGY_LANES, MORPHOLOGY_STRIP), Operation::identity);
+    auto size = 2 * radius + 1;
+    auto padded = (count + 2 * radius + size - 1) / size * size;
+    forward.resize((size_t) padded * lanes);
+    backward.resize((size_t) padded * lanes);
+    auto sample = [&](int j) {
+        auto index = j - radius;
+        return index >= 0 && index < count ? data + index * stride : outside.data();
+    };
+    for(int j = 0; j < padded; j++) {
+        auto in = sample(j);
+        auto out = forward.data() + (size_t) j * lanes;
+        if(j % size == 0) {
+            std::copy(in, in + lanes, out);
+            continue;
+        }
+        auto previous = out - lanes;
+        for(int lane = 0; lane < lanes; lane++)
+            out[lane] = Operation::apply(previous[lane], in[lane]);
+    }
+    for(int j = padded - 1; j >= 0; j--) {
+        auto in = sample(j);
+        auto out = backward.data() + (size_t) j * lanes;
+        if(j % size == size - 1) {
+            std::copy(in, in + lanes, out);
+            continue;
+        }
+        auto next = out + lanes;
+        for(int lane = 0; lane < lanes; lane++)
+            out[lane] = Operation::apply(next[lane], in[lane]);
+    }
+    for(int x = 0; x < count; x++) {
+        auto start = backward.data() + (size_t) x * lanes;
+        auto end = forward.data() + (size_t) (x + 2 * radius) * lanes;
+        auto out = data + x * stride;
+        for(int lane = 0; lane < lanes; lane++)
+            out[lane] = Operation::apply(start[lane], end[lane]);
+    }
+}
+
+template<typename Operation>
+static void rectangle(const PlanarImage &source, PlanarImage &target, int radiusX, int radiusY) {
+    auto width = source.width();
+    auto height = source.height();
+    auto groups = (height + MORPHOLOGY_LANES - 1) / MORPHOLOGY_LANES;
+    auto strips = (width + MORPHOLOGY_STRIP - 1) / MORPHOLOGY_STRIP;
+    auto threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+    for(int channel = 0; channel < source.channels(); channel++) {
+        // Horizontal, source to target: MORPHOLOGY_LANES rows interleaved so
+        // each step is one vector operation across the rows.
+        parallelRows(groups, [&](int begin, int end) {
+            std::vector<BYTE> lines((size_t) width * MORPHOLOGY_LANES), forward, backward;
+            for(int group = begin; group < end; group++) {
+                auto top = group * MORPHOLOGY_LANES;
+                auto lanes = std::min(MORPHOLOGY_LANES, height - top);
+                for(int lane = 0; lane < lanes; lane++) {
+                    auto in = source.row(channel, top + lane);
+                    for(int x = 0; x < width; x++)
+                        lines[(size_t) x * MORPHOLOGY_LANES + lane] = in[x];
+                }
+                vanHerkLine<Operation>(lines.data(), width, MORPHOLOGY_LANES, lanes, radiusX, forward, backward);
+                for(int lane = 0; lane < lanes; lane++) {
+                    auto out = target.row(channel, top + lane);
+                    for(int x = 0; x < width; x++)
+                        out[x] = lines[(size_t) x * MORPHOLOGY_LANES + lane];
+                }
+            }
+        });
+        // Vertical, in place on target: rows are contiguous, so a strip of
+        // columns is one vector operation per row.
+        parallelBands(strips, std::min(strips, threads), [&](int begin, int end) {
+            std::vector<BYTE> forward, backward;
+            for(int strip = begin; strip < end; strip++) {
+                auto left = strip * MORPHOLOGY_STRIP;
+                auto columns = std::min(MORPHOLOGY_STRIP, width - left);
+                vanHerkLine<Operation>(target.row(channel, 0) + left, height, target.stride(), columns, radiusY, forward, backward);
+            }
+        });
+    }
+}
+
+void morphologyPlanar(const PlanarImage &source, PlanarImage &target, MorphologyOperation operation, int radiusX, int radiusY) {
+    radiusX = std::clamp(radiusX, 0, MORPHOLOGY_MAX_RADIUS);
+    radiusY = std::clamp(radiusY, 0, MORPHOLOGY_MAX_RADIUS);
+    switch(operation) {
+    case MorphologyOperation::Erode:
+        rectangle<Minimum>(source, target, radiusX, radiusY);
+        return;
+    case MorphologyOperation::Dilate:
+        rectangle<Maximum>(source, target, radiusX, radiusY);
+        return;
+    case MorphologyOperation::Open: {
+        PlanarImage eroded(source.width(), source.height(), source.channels());
+        rectangle<Minimum>(source, eroded, radiusX, radiusY);
+        rectangle<Maximum>(eroded, target, radiusX, radiusY);
+        return;
+    }
+    case MorphologyOperation::Close: {
+        PlanarImage dilated(source.width(), source.height(), source.channels());
+        rectangle<Maximum>(source, dilated, radiusX, radiusY);
+        rectangle<Minimum>(dilated, target, radiusX, radiusY);
+        return;
+    }
+    case MorphologyOperation::TopHat:
+        morphologyPlanar(source, target, MorphologyOperation::Open, radiusX, radiusY);
+        // The opening never exceeds the source, so the difference cannot
+        // wrap.
+        for(int channel = 0; channel < source.channels(); channel++) {
+            parallelRows(source.height(), [&](int begin, int end) {
+                for(int y = begin; y < end; y++) {
+                    auto in = source.row(channel, y);
+                    auto out = target.row(channel, y);
+                    for(int x = 0; x < source.width(); x++)
+                        out[x] = in[x] - out[x];
+                }
+            });
+        }
+        return;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include "planar_image.h"
+
+#define MORPHOLOGY_MAX_RADIUS 1024
+#define MORPHOLOGY_DEFAULT_RADIUS 2
+
+// Order matches the morphology combo box.
+enum class MorphologyOperation {
+    Erode,
+    Dilate,
+    Open,
+    Close,
+    TopHat,
+};
+
+// Grayscale morphology of every plane with a flat (2 * radiusX + 1) by
+// (2 * radiusY + 1) rectangle into target, which must have the source's size
+// and channel count. Pixels outside the image are ignored. TopHat is the
+// source minus its opening.
+//
+// Each axis runs the van Herk/Gil-Werman algorithm: the line is cut into
+// blocks as long as the element, with a running minimum (or maximum) forward
+// and one backward inside each block, and every window is the combination of
+// one value from each. That is about three comparisons per pixel per axis
+// whatever the radius. Rows are processed sixteen at a time, interleaved, and
+// columns in strips, so every comparison is a vector min or max.
+void morphologyPlanar(const PlanarImage &source, PlanarImage &target, MorphologyOperation operation, int radiusX, int radiusY);
+
+#endif // MORPHOLOGY_H
@@ -0,0 +1,206 @@
+#include "palette.h"
+#include "kernels.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define PALETTE_CACHE_SIZE (1 << (3 * PALETTE_CACHE_BITS))
+#define PALETTE_CACHE_SIDE (1 << PALETTE_CACHE_BITS)
+
+static inline int cellIndex(int red, int green, int blue) {
+    return (red << (2 * PALETTE_CACHE_BITS)) | (green << PALETTE_CACHE_BITS) | blue;
+}
+
+Palette::Palette(QVector<QRgb> colors) {
+    colorTable = colors.mid(0, PALETTE_MAX_COLORS);
+    if(colorTable.isEmpty())
+        return;
+    cells.resize(PALETTE_CACHE_SIZE);
+    std::vector<int> reds, greens, blues;
+    for(auto color : colorTable) {
+        reds.push_back(qRed(color));
+        greens.push_back(qGreen(color));
+        blues.push_back(qBlue(color));
+    }
+    auto count = colorTable.size();
+    parallelRows(PALETTE_CACHE_SIZE, [&](int begin, int end) {
+        std::vector<int> distances(count);
+        for(int cell = begin; cell < end; cell++) {
+            auto shift = 8 - PALETTE_CACHE_BITS;
+            auto half = 1 << (shift - 1);
+            auto red = ((cell >> (2 * PALETTE_CACHE_BITS)) << shift) + half;
+            auto green = (((cell >> PALETTE_CACHE_BITS) & (PALETTE_CACHE_SIDE - 1)) << shift) + half;
+            auto blue = ((cell & (PALETTE_CACHE_SIDE - 1)) << shift) + half;
+            for(int i = 0; i < count; i++) {
+                auto dr = reds[i] - red, dg = greens[i] - green, db = blues[i] - blue;
+                distances[i] = dr * dr + dg * dg + db * db;
+            }
+            cells[cell] = std::min_element(distances.begin(), distances.end()) - distances.begin();
+        }
+    });
+}
+
+int Palette::nearest(QRgb color) const {
+    auto shift = 8 - PALETTE_CACHE_BITS;
+    return cells[cellIndex(qRed(color) >> shift, qGreen(color) >> shift, qBlue(color) >> shift)];
+}
+
+namespace {
+
+struct ColorBox {
+    int low[3], high[3];
+    quint64 count;
+};
+
+class MedianCut {
+public:
+    std::vector<quint64> counts;
+    std::vector<quint64> sums[3];
+
+    MedianCut() : counts(PALETTE_CACHE_SIZE) {
+        for(auto &sum : sums)
+            sum.resize(PALETTE_CACHE_SIZE);
+    }
+
+    void shrink(ColorBox &box) const {
+        int low[3] = {PALETTE_CACHE_SIDE, PALETTE_CACHE_SIDE, PALETTE_CACHE_SIDE}, high[3] = {-1, -1, -1};
+        box.count = 0;
+        forEachCell(box, [&](int cell, int red, int green, int blue) {
+            if(counts[cell] == 0)
+                return;
+            int values[3] = {red, green, blue};
+            for(int axis = 0; axis < 3; axis++) {
+                low[axis] = std::min(low[axis], values[axis]);
+                high[axis] = std::max(high[axis], values[axis]);
+            }
+            box.count += counts[cell];
+        });
+        if(box.count == 0)
+            return;
+        std::copy(low, low + 3, box.low);
+        std::copy(high, high + 3, box.high);
+    }
+
+    bool split(const ColorBox &box, ColorBox &first, ColorBox &second) const {
+        auto axis = 0;
+        for(int i = 1; i < 3; i++)
+            if(box.high[i] - box.low[i] > box.high[axis] - box.low[axis])
+                axis = i;
+        if(box.high[axis] == box.low[axis])
+            return false;
+        std::vector<quint64> slices(PALETTE_CACHE_SIDE);
+        forEachCell(box, [&](int cell, int red, int green, int blue) {
+            int values[3] = {red, green, blue};
+            slices[values[axis]] += counts[cell];
+        });
+        quint64 running = 0;
+        auto median = box.low[axis];
+        for(; median < box.high[axis] - 1; median++) {
+            running += slices[median];
+            if(running * 2 >= box.count)
+                break;
+        }
+        first = second = box;
+        first.high[axis] = median;
+        second.low[axis] = median + 1;
+        shrink(first);
+        shrink(second);
+        return first.count > 0 && second.count > 0;
+    }
+
+    QRgb average(const ColorBox &box) const {
+        quint64 totals[3] = {};
+        forEachCell(box, [&](int cell, int, int, int) {
+            for(int channel = 0; channel < 3; channel++)
+                totals[channel] += sums[channel][cell];
+        });
+        auto count = std::max<quint64>(1, box.count);
+        return qRgb((totals[0] + count / 2) / count, (totals[1] + count / 2) / count, (totals[2] + count / 2) / count);
+    }
+
+private:
+    template<typename Action>
+    void forEachCell(const ColorBox &box, Action action) const {
+        for(int red = box.low[0]; red <= box.high[0]; red++)
+            for(int green = box.low[1]; green <= box.high[1]; green++)
+                for(int blue = box.low[2]; blue <= box.high[2]; blue++)
+                    action(cellIndex(red, green, blue), red, green, blue);
+    }
+};
+
+} // namespace
+
+Palette Palette::build(const QImage &source, int colors) {
+    colors = std::clamp(colors, 1, PALETTE_MAX_COLORS);
+    auto image = source.depth() == 32 ? source : source.convertToFormat(QImage::Format_RGB32);
+    if(image.isNull())
+        return Palette();
+    MedianCut cut;
+    auto pixels = (qint64) image.width() * image.height();
+    auto step = std::max(1, (int) std::ceil(std::sqrt(pixels / (double) PALETTE_SAMPLE_COUNT)));
+    auto shift = 8 - PALETTE_CACHE_BITS;
+    for(int y = step / 2; y < image.height(); y += step) {
+        auto line = (const QRgb*) image.constScanLine(y);
+        for(int x = step / 2; x < image.width(); x += step) {
+            auto pixel = line[x];
+            auto cell = cellIndex(qRed(pixel) >> shift, qGreen(pixel) >> shift, qBlue(pixel) >> shift);
+            cut.counts[cell]++;
+            cut.sums[0][cell] += qRed(pixel);
+            cut.sums[1][cell] += qGreen(pixel);
+            cut.sums[2][cell] += qBlue(pixel);
+        }
+    }
+    ColorBox full = {{0, 0, 0}, {PALETTE_CACHE_SIDE - 1, PALETTE_CACHE_SIDE - 1, PALETTE_CACHE_SIDE - 1}, 0};
+    cut.shrink(full);
+    std::vector<ColorBox> boxes = {full};
+    std::vector<bool> splittable = {true};
+    while((int) boxes.size() < colors) {
+        // Split the box that covers the most samples over the widest range.
+        auto best = -1;
+        quint64 bestScore = 0;
+        for(size_t i = 0; i < boxes.size(); i++) {
+            if(!splittable[i])
+                continue;
+            auto &box = boxes[i];
+            auto extent = std::max({box.high[0] - box.low[0], box.high[1] - box.low[1], box.high[2] - box.low[2]});
+            auto score = box.count * (quint64) extent;
+            if(extent > 0 && score >= bestScore) {
+                best = i;
+                bestScore = score;
+            }
+        }
+        if(best < 0)
+            break;
+        ColorBox first, second;
+        if(!cut.split(boxes[best], first, second)) {
+            splittable[best] = false;
+            continue;
+        }
+        boxes[best] = first;
+        boxes.push_back(second);
+        splittable.push_back(true);
+    }
+    QVector<QRgb> palette;
+    for(auto &box : boxes)
+        palette << cut.average(box);
+    return Palette(palette);
+}
+
+void applyPalette(QImage &image, QRect rect, const Palette &palette) {
+    if(palette.isEmpty())
+        return;
+    rect = rect.intersected(image.rect());
+    if(rect.isEmpty())
+        return;
+    auto colors = palette.colors();
+    // Detach on this thread; scanLine() in the workers would race on a
+    // shared image.
+    auto stride = image.bytesPerLine();
+    auto first = image.bits() + rect.top() * stride;
+    auto paletteRow = kernels().paletteRow;
+    parallelRows(rect.height(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+            paletteRow((QRgb*) (first + y * stride) + rect.left(), rect.width(), palette.cache(), colors.constData());
+    });
+}
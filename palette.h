@@ -0,0 +1,48 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include "definitions.h"
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+#include <vector>
+
+#define PALETTE_CACHE_BITS 5
+#define PALETTE_MAX_COLORS 256
+#define PALETTE_SAMPLE_COUNT (1024 * 1024)
+
+// Colour palette plus a 32x32x32 cache mapping every 5-bit-per-channel
+// cell to its nearest palette entry, so assigning a pixel is one table
+// lookup instead of a search over the palette.
+class Palette {
+public:
+    Palette() = default;
+    Palette(QVector<QRgb> colors);
+
+    // Median cut over a subsampled 5-bit histogram of the image.
+    static Palette build(const QImage &image, int colors);
+
+    bool isEmpty() const {
+        return colorTable.isEmpty();
+    }
+
+    QVector<QRgb> colors() const {
+        return colorTable;
+    }
+
+    const BYTE *cache() const {
+        return cells.data();
+    }
+
+    int nearest(QRgb color) const;
+
+private:
+    QVector<QRgb> colorTable;
+    std::vector<BYTE> cells;
+};
+
+void applyPalette(QImage &image, QRect rect, const Palette &palette);
+
+#endif // PALETTE_H
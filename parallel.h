@@ -0,0 +1,67 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#define PARALLEL_MIN_ROWS 16
+
+// Number of contiguous bands [0, rows) is split into: one or a few per pool
+// thread, or a single band for small ranges.
+inline int rowBands(int rows) {
+    auto threads = std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+    if(threads == 1)
+        return 1;
+    return std::min(threads * 4, std::max(1, rows / PARALLEL_MIN_ROWS));
+}
+
+// Runs [0, rows) split into the given number of contiguous bands on the
+// global pool. Suits kernels with a per-band setup cost, which want fewer,
+// taller bands than parallelRows() picks.
+inline void parallelBands(int rows, int bands, std::function<void(int, int)> action) {
+    bands = std::clamp(bands, 1, std::max(1, rows));
+    if(bands == 1) {
+        action(0, rows);
+        return;
+    }
+    QList<int> indices;
+    for(int i = 0; i < bands; i++)
+        indices << i;
+    QtConcurrent::blockingMap(indices, [rows, bands, &action](int band) {
+        action((qint64) rows * band / bands, (qint64) rows * (band + 1) / bands);
+    });
+}
+
+// Runs the bands of [0, rows) on the global pool. Small ranges run inline.
+inline void parallelRows(int rows, std::function<void(int, int)> action) {
+    parallelBands(rows, rowBands(rows), action);
+}
+
+// Map-reduce over the same bands. Every band folds its rows into its own
+// copy of identity through map(partial, begin, end); the partials are then
+// merged in band order on the calling thread, so the result does not depend
+// on how the pool scheduled the bands.
+template<typename Partial, typename Map, typename Merge>
+Partial parallelReduce(int rows, const Partial &identity, Map map, Merge merge) {
+    auto bands = rowBands(rows);
+    std::vector<Partial> partials(bands, identity);
+    if(bands <= 1) {
+        map(partials[0], 0, rows);
+        return partials[0];
+    }
+    QList<int> indices;
+    for(int i = 0; i < bands; i++)
+        indices << i;
+    QtConcurrent::blockingMap(indices, [rows, bands, &partials, &map](int band) {
+        map(partials[band], (int) ((qint64) rows * band / bands), (int) ((qint64) rows * (band + 1) / bands));
+    });
+    for(int band = 1; band < bands; band++)
+        merge(partials[0], partials[band]);
+    return partials[0];
+}
+
+#endif // PARALLEL_H
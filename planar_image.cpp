@@ -0,0 +1,256 @@
+#include "planar_image.h"
+#include "buffer_pool.h"
+#include "kernels.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+PlanarImage::PlanarImage(int width, int height, int channels) {
+    imageWidth = width;
+    imageHeight = height;
+    planeCount = channels;
+    rowStride = (width + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+    auto bytes = std::max<size_t>(1, (size_t) rowStride * height * channels);
+    storage = BufferPool::instance().acquire(bytes);
+    base = storage.get();
+}
+
+PlanarImage PlanarImage::fromImage(const QImage &image) {
+    if(image.format() == QImage::Format_Grayscale8) {
+        PlanarImage result(image.width(), image.height(), 1);
+        parallelRows(result.height(), [&result, &image](int begin, int end) {
+            for(int y = begin; y < end; y++)
+                memcpy(result.row(0, y), image.constScanLine(y), result.width());
+        });
+        return result;
+    }
+    auto converted = image.convertToFormat(QImage::Format_RGB32);
+    PlanarImage result(converted.width(), converted.height());
+    auto deinterleaveRow = kernels().deinterleaveRow;
+    parallelRows(result.height(), [&result, &converted, deinterleaveRow](int begin, int end) {
+        for(int y = begin; y < end; y++)
+            deinterleaveRow((const QRgb*) converted.constScanLine(y), result.row(0, y), result.row(1, y), result.row(2, y), result.width());
+    });
+    return result;
+}
+
+QImage PlanarImage::toImage() const {
+    if(planeCount == 1) {
+        auto result = BufferPool::instance().image(imageWidth, imageHeight, QImage::Format_Grayscale8);
+        auto out = result.bits();
+        auto outStride = result.bytesPerLine();
+        parallelRows(imageHeight, [this, out, outStride](int begin, int end) {
+            for(int y = begin; y < end; y++)
+                memcpy(out + y * outStride, row(0, y), imageWidth);
+        });
+        return result;
+    }
+    auto result = BufferPool::instance().image(imageWidth, imageHeight, QImage::Format_RGB32);
+    auto out = result.bits();
+    auto outStride = result.bytesPerLine();
+    auto interleaveRow = kernels().interleaveRow;
+    parallelRows(imageHeight, [this, out, outStride, interleaveRow](int begin, int end) {
+        for(int y = begin; y < end; y++)
+            interleaveRow(row(0, y), row(1, y), row(2, y), (QRgb*) (out + y * outStride), imageWidth);
+    });
+    return result;
+}
+
+void convolvePlanar(const PlanarImage &source, PlanarImage &target, const double kernel[3][3], bool add) {
+    float weights[9];
+    for(int i = 0; i < 9; i++)
+        weights[i] = kernel[i / 3][i % 3];
+    auto increment = add ? 127.0f : 0.0f;
+    auto width = source.width();
+    auto height = source.height();
+    auto convolveRow = kernels().convolveRow;
+    parallelRows(height, [&](int begin, int end) {
+        for(int channel = 0; channel < source.channels(); channel++) {
+            for(int y = begin; y < end; y++) {
+                auto out = target.row(channel, y);
+                auto center = source.row(channel, y);
+                if(y == 0 || y == height - 1 || width < 3) {
+                    memcpy(out, center, width);
+                    continue;
+                }
+                out[0] = center[0];
+                out[width - 1] = center[width - 1];
+                convolveRow(source.row(channel, y - 1), center, source.row(channel, y + 1), out, width, weights, increment);
+            }
+        }
+    });
+}
+
+PlanarImage zoomOutPlanar(const PlanarImage &source, int offsetX, int offsetY) {
+    PlanarImage result((source.width() + offsetX - 1) / offsetX, (source.height() + offsetY - 1) / offsetY, source.channels());
+    parallelRows(result.height(), [&](int begin, int end) {
+        std::vector<int> sums(result.width());
+        for(int channel = 0; channel < source.channels(); channel++) {
+            for(int y = begin; y < end; y++) {
+                std::fill(sums.begin(), sums.end(), 0);
+                auto firstRow = y * offsetY;
+                auto lastRow = std::min(firstRow + offsetY, source.height());
+                for(int sourceRow = firstRow; sourceRow < lastRow; sourceRow++) {
+                    auto in = source.row(channel, sourceRow);
+                    for(int x = 0; x < result.width(); x++) {
+                        auto start = x * offsetX;
+                        auto stop = std::min(start + offsetX, source.width());
+                        int sum = 0;
+                        for(int column = start; column < stop; column++)
+                            sum += in[column];
+                        sums[x] += sum;
+                    }
+                }
+                auto out = result.row(channel, y);
+                auto rows = lastRow - firstRow;
+                for(int x = 0; x < result.width(); x++) {
+                    auto columns = std::min(offsetX, source.width() - x * offsetX);
+                    out[x] = sums[x] / (rows * columns);
+                }
+            }
+        }
+    });
+    return result;
+}
+
+PlanarImage zoomInPlanar(const PlanarImage &source) {
+    auto width = source.width() * 2 - 1;
+    auto height = source.height() * 2 - 1;
+    PlanarImage result(width, height, source.channels());
+    auto &table = kernels();
+    parallelRows(source.height(), [&](int begin, int end) {
+        for(int channel = 0; channel < source.channels(); channel++)
+            for(int y = begin; y < end; y++)
+                table.upsampleRow(source.row(channel, y), result.row(channel, y * 2), source.width());
+    });
+    parallelRows(source.height() - 1, [&](int begin, int end) {
+        for(int channel = 0; channel < source.channels(); channel++)
+            for(int y = begin; y < end; y++)
+                table.averageRows(result.row(channel, y * 2), result.row(channel, y * 2 + 2), result.row(channel, y * 2 + 1), width);
+    });
+    return result;
+}
+
+void luminanceHistogramPlanar(const PlanarImage &source, quint64 counts[256]) {
+    auto luminanceRow = kernels().luminanceRow;
+    auto result = parallelReduce(source.height(), std::array<quint64, 256>{}, [&](std::array<quint64, 256> &partial, int begin, int end) {
+        std::vector<BYTE> luminance(source.width());
+        for(int y = begin; y < end; y++) {
+            if(source.channels() == 1) {
+                auto gray = source.row(0, y);
+                for(int x = 0; x < source.width(); x++)
+                    partial[gray[x]]++;
+                continue;
+            }
+            luminanceRow(source.row(0, y), source.row(1, y), source.row(2, y), luminance.data(), source.width());
+            for(int x = 0; x < source.width(); x++)
+                partial[luminance[x]]++;
+        }
+    }, [](std::array<quint64, 256> &result, const std::array<quint64, 256> &partial) {
+        for(int i = 0; i < 256; i++)
+            result[i] += partial[i];
+    });
+    std::copy(result.begin(), result.end(), counts);
+}
+
+// The image may be shared with the viewport or the ImageCache, so it is
+// detached once here; scanLine() in the workers would detach concurrently.
+void applyLookup(QImage &image, QRect rect, const ChannelLookup &lookup) {
+    rect = rect.intersected(image.rect());
+    if(rect.isEmpty())
+        return;
+    auto stride = image.bytesPerLine();
+    auto first = image.bits() + rect.top() * stride;
+    if(image.format() == QImage::Format_Grayscale8) {
+        auto lookupGrayRow = kernels().lookupGrayRow;
+        parallelRows(rect.height(), [&](int begin, int end) {
+            for(int y = begin; y < end; y++)
+                lookupGrayRow(first + y * stride + rect.left(), rect.width(), lookup.table[0]);
+        });
+        return;
+    }
+    auto lookupRow = kernels().lookupRow;
+    parallelRows(rect.height(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+            lookupRow((QRgb*) (first + y * stride) + rect.left(), rect.width(), lookup.table);
+    });
+}
+
+QImage rotateImage(const QImage &source, bool clockwise) {
+    if(source.format() == QImage::Format_Grayscale8) {
+        auto result = BufferPool::instance().image(source.height(), source.width(), QImage::Format_Grayscale8);
+        auto in = source.constBits();
+        auto inStride = source.bytesPerLine();
+        auto out = result.bits();
+        auto outStride = result.bytesPerLine();
+        auto transposeGrayBlock = kernels().transposeGrayBlock;
+        parallelRows(source.height(), [&](int begin, int end) {
+            if(clockwise)
+                transposeGrayBlock(in + begin * inStride, inStride, out + source.height() - 1 - begin, outStride, -1, source.width(), end - begin);
+            else
+                transposeGrayBlock(in + begin * inStride, inStride, out + (qsizetype) (source.width() - 1) * outStride + begin, -outStride, 1, source.width(), end - begin);
+        });
+        return result;
+    }
+    auto image = source.depth() == 32 ? source : source.convertToFormat(QImage::Format_RGB32);
+    auto result = BufferPool::instance().image(image.height(), image.width(), QImage::Format_RGB32);
+    auto in = (const QRgb*) image.constBits();
+    auto inStride = image.bytesPerLine() / (qsizetype) sizeof(QRgb);
+    auto out = (QRgb*) result.bits();
+    auto outStride = result.bytesPerLine() / (qsizetype) sizeof(QRgb);
+    auto transposeBlock = kernels().transposeBlock;
+    parallelRows(image.height(), [&](int begin, int end) {
+        if(clockwise)
+            transposeBlock(in + begin * inStride, inStride, out + image.height() - 1 - begin, outStride, -1, image.width(), end - begin);
+        else
+            transposeBlock(in + begin * inStride, inStride, out + (qsizetype) (image.width() - 1) * outStride + begin, -outStride, 1, image.width(), end - begin);
+    });
+    return result;
+}
+
+QImage grayscaleImage(const QImage &source) {
+    if(source.format() == QImage::Format_Grayscale8)
+        return source;
+    auto image = source.depth() == 32 ? source : source.convertToFormat(QImage::Format_RGB32);
+    auto result = BufferPool::instance().image(image.width(), image.height(), QImage::Format_Grayscale8);
+    auto out = result.bits();
+    auto outStride = result.bytesPerLine();
+    auto grayscaleRow = kernels().grayscaleRow;
+    parallelRows(image.height(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++)
+            grayscaleRow((const QRgb*) image.constScanLine(y), out + y * outStride, image.width());
+    });
+    return result;
+}
+
+QImage mirrorImage(const QImage &source, bool horizontal) {
+    auto result = BufferPool::instance().image(source.width(), source.height(), source.format());
+    auto bytesPerPixel = source.depth() / 8;
+    auto rowBytes = (qsizetype) source.width() * bytesPerPixel;
+    auto target = result.bits();
+    auto targetStride = result.bytesPerLine();
+    parallelRows(source.height(), [&](int begin, int end) {
+        for(int y = begin; y < end; y++) {
+            auto in = source.constScanLine(horizontal ? y : source.height() - 1 - y);
+            auto out = target + y * targetStride;
+            if(!horizontal) {
+                memcpy(out, in, rowBytes);
+            } else if(bytesPerPixel == 1) {
+                std::reverse_copy(in, in + rowBytes, out);
+            } else {
+                std::reverse_copy((const QRgb*) in, (const QRgb*) in + source.width(), (QRgb*) out);
+            }
+        }
+    });
+    return result;
+}
+
+void copyRegion(const QImage &source, QRect sourceRect, QImage &target, QPoint position) {
+    auto bytesPerPixel = source.depth() / 8;
+    for(int y = 0; y < sourceRect.height(); y++)
+        memcpy(target.scanLine(position.y() + y) + (qsizetype) position.x() * bytesPerPixel,
+               source.constScanLine(sourceRect.top() + y) + (qsizetype) sourceRect.left() * bytesPerPixel,
+               (qsizetype) sourceRect.width() * bytesPerPixel);
+}
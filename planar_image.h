@@ -0,0 +1,76 @@
+#ifndef PLANAR_IMAGE_H
+#define PLANAR_IMAGE_H
+
+#include "buffer_pool.h"
+#include "definitions.h"
+#include "kernels.h"
+
+#include <QImage>
+
+#include <memory>
+
+#define PLANE_ALIGNMENT BUFFER_ALIGNMENT
+
+// Structure-of-arrays image: one 8-bit plane per channel (one plane for
+// Format_Grayscale8 sources, three otherwise), rows padded to
+// PLANE_ALIGNMENT bytes. Kernels run on the planes directly; the interleaved
+// QImage form is only produced at the load and display boundaries. Copies
+// share the same pixels, which come from the BufferPool.
+class PlanarImage {
+public:
+    PlanarImage() = default;
+    PlanarImage(int width, int height, int channels = DEFAULT_CHANNEL_COUNT);
+
+    static PlanarImage fromImage(const QImage &image);
+    QImage toImage() const;
+
+    bool isNull() const {
+        return planeCount == 0;
+    }
+
+    int width() const {
+        return imageWidth;
+    }
+
+    int height() const {
+        return imageHeight;
+    }
+
+    int channels() const {
+        return planeCount;
+    }
+
+    int stride() const {
+        return rowStride;
+    }
+
+    BYTE *row(int channel, int y) {
+        return base + ((qint64) channel * imageHeight + y) * rowStride;
+    }
+
+    const BYTE *row(int channel, int y) const {
+        return base + ((qint64) channel * imageHeight + y) * rowStride;
+    }
+
+private:
+    int imageWidth = 0, imageHeight = 0;
+    int planeCount = 0;
+    int rowStride = 0;
+    std::shared_ptr<BYTE> storage;
+    BYTE *base = nullptr;
+};
+
+void convolvePlanar(const PlanarImage &source, PlanarImage &target, const double kernel[3][3], bool add);
+PlanarImage zoomOutPlanar(const PlanarImage &source, int offsetX, int offsetY);
+PlanarImage zoomInPlanar(const PlanarImage &source);
+void luminanceHistogramPlanar(const PlanarImage &source, quint64 counts[256]);
+
+// Interleaved helpers. Each accepts Format_Grayscale8 as well as 32-bit
+// images; grayscale lookups use the first channel's table.
+void applyLookup(QImage &image, QRect rect, const ChannelLookup &lookup);
+QImage rotateImage(const QImage &image, bool clockwise);
+QImage mirrorImage(const QImage &image, bool horizontal);
+QImage grayscaleImage(const QImage &image);
+void copyRegion(const QImage &source, QRect sourceRect, QImage &target, QPoint position);
+
+#endif // PLANAR_IMAGE_H
@@ -0,0 +1,127 @@
+#include "rank_filter.h"
+#include "parallel.h"
+
+#include <QThreadPool>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#define COARSE_BINS 16
+#define FINE_BINS 256
+
+// Histograms of the 2 * radius + 1 rows around the current row, one per
+// column. Fine bins of a column are contiguous, so coarse bin b's fine
+// segment is fine[x * FINE_BINS + b * COARSE_BINS ...].
+struct ColumnHistograms {
+    std::vector<quint16> coarse;
+    std::vector<quint16> fine;
+
+    ColumnHistograms(int width) : coarse((size_t) width * COARSE_BINS), fine((size_t) width * FINE_BINS) {}
+
+    void add(const BYTE *row, int width, int delta) {
+        for(int x = 0; x < width; x++) {
+            coarse[(size_t) x * COARSE_BINS + (row[x] >> 4)] += delta;
+            fine[(size_t) x * FINE_BINS + row[x]] += delta;
+        }
+    }
+};
+
+static void addSegment(quint16 *target, const quint16 *added, const quint16 *removed) {
+    for(int i = 0; i < COARSE_BINS; i++)
+        target[i] += added[i] - removed[i];
+}
+
+static void rankBand(const PlanarImage &source, PlanarImage &target, int channel, int begin, int end, int radius, int rank) {
+    auto width = source.width();
+    auto lastRow = source.height() - 1;
+    auto lastColumn = width - 1;
+    auto clampRow = [lastRow](int y) {
+        return std::clamp(y, 0, lastRow);
+    };
+    auto clampColumn = [lastColumn](int x) {
+        return std::clamp(x, 0, lastColumn);
+    };
+    ColumnHistograms columns(width);
+    for(int dy = -radius; dy <= radius; dy++)
+        columns.add(source.row(channel, clampRow(begin + dy)), width, 1);
+
+    quint16 coarse[COARSE_BINS];
+    quint16 fine[FINE_BINS];
+    int synced[COARSE_BINS];
+    for(int y = begin; y < end; y++) {
+        if(y > begin) {
+            auto removed = clampRow(y - radius - 1);
+            auto added = clampRow(y + radius);
+            if(removed != added) {
+                columns.add(source.row(channel, removed), width, -1);
+                columns.add(source.row(channel, added), width, 1);
+            }
+        }
+        std::fill(coarse, coarse + COARSE_BINS, 0);
+        std::fill(synced, synced + COARSE_BINS, INT_MIN);
+        for(int dx = -radius; dx <= radius; dx++) {
+            auto column = columns.coarse.data() + (size_t) clampColumn(dx) * COARSE_BINS;
+            for(int i = 0; i < COARSE_BINS; i++)
+                coarse[i] += column[i];
+        }
+        auto out = target.row(channel, y);
+        for(int x = 0; x < width; x++) {
+            if(x > 0) {
+                auto added = clampColumn(x + radius);
+                auto removed = clampColumn(x - radius - 1);
+                if(added != removed)
+                    addSegment(coarse, columns.coarse.data() + (size_t) added * COARSE_BINS, columns.coarse.data() + (size_t) removed * COARSE_BINS);
+            }
+            int below = 0, bin = 0;
+            while(below + coarse[bin] <= rank)
+                below += coarse[bin++];
+            // Bring this bin's fine segment up to x: slide it column by
+            // column from where it was last used, or rebuild it when that
+            // is further back than half the kernel.
+            auto segment = fine + bin * COARSE_BINS;
+            auto offset = bin * COARSE_BINS;
+            if(synced[bin] == INT_MIN || x - synced[bin] > radius) {
+                std::fill(segment, segment + COARSE_BINS, 0);
+                for(int dx = -radius; dx <= radius; dx++) {
+                    auto column = columns.fine.data() + (size_t) clampColumn(x + dx) * FINE_BINS + offset;
+                    for(int i = 0; i < COARSE_BINS; i++)
+                        segment[i] += column[i];
+                }
+            } else {
+                for(int step = synced[bin] + 1; step <= x; step++) {
+                    auto added = clampColumn(step + radius);
+                    auto removed = clampColumn(step - radius - 1);
+                    if(added != removed)
+                        addSegment(segment, columns.fine.data() + (size_t) added * FINE_BINS + offset, columns.fine.data() + (size_t) removed * FINE_BINS + offset);
+                }
+            }
+            synced[bin] = x;
+            int level = 0;
+            while(below + segment[level] <= rank)
+                below += segment[level++];
+            out[x] = offset + level;
+        }
+    }
+}
+
+void rankFilterPlanar(const PlanarImage &source, PlanarImage &target, int radius, double percentile) {
+    radius = std::clamp(radius, 0, RANK_FILTER_MAX_RADIUS);
+    if(radius == 0) {
+        for(int channel = 0; channel < source.channels(); channel++)
+            for(int y = 0; y < source.height(); y++)
+                memcpy(target.row(channel, y), source.row(channel, y), source.width());
+        return;
+    }
+    auto side = 2 * radius + 1;
+    auto rank = (int) std::lround(std::clamp(percentile, 0.0, 1.0) * (side * side - 1));
+    // Every band rebuilds its column histograms from 2 * radius + 1 rows,
+    // so use one tall band per thread rather than parallelRows' many.
+    auto bands = std::min(QThreadPool::globalInstance()->maxThreadCount(), std::max(1, source.height() / side));
+    parallelBands(source.height(), bands, [&](int begin, int end) {
+        for(int channel = 0; channel < source.channels(); channel++)
+            rankBand(source, target, channel, begin, end, radius, rank);
+    });
+}
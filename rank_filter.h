@@ -0,0 +1,22 @@
+#ifndef RANK_FILTER_H
+#define RANK_FILTER_H
+
+#include "planar_image.h"
+
+#define RANK_FILTER_MAX_RADIUS 127
+#define RANK_FILTER_DEFAULT_RADIUS 5
+
+// Square (2 * radius + 1)^2 rank filter of every plane into target, which
+// must have the source's size and channel count. percentile 0.5 is the
+// median, 0 the minimum and 1 the maximum. Borders replicate the edge
+// pixels.
+//
+// Constant time per pixel (Perreault and Hebert): every column keeps a
+// histogram of its 2 * radius + 1 rows that slides down one row at a time,
+// and the kernel histogram slides across by adding one column histogram and
+// removing another. Histograms are split into 16 coarse and 256 fine bins;
+// only the coarse part is slid for every pixel, and a fine segment is
+// brought up to date only when the rank lands in it.
+void rankFilterPlanar(const PlanarImage &source, PlanarImage &target, int radius, double percentile);
+
+#endif // RANK_FILTER_H
@@ -0,0 +1,98 @@
+#include "raw_image.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <cstring>
+#include <memory>
+
+bool RawImage::isRawImage(QString path) {
+    return QFileInfo(path).suffix().toLower() == RAW_IMAGE_SUFFIX;
+}
+
+RawImageHeader RawImage::header(QSize size, QImage::Format format) {
+    RawImageHeader header;
+    memcpy(header.magic, RAW_IMAGE_MAGIC, sizeof(header.magic));
+    header.width = size.width();
+    header.height = size.height();
+    auto bytesPerLine = (QImage::toPixelFormat(format).bitsPerPixel() * (qint64) size.width() + 7) / 8;
+    header.bytesPerLine = (bytesPerLine + RAW_IMAGE_ROW_ALIGNMENT - 1) / RAW_IMAGE_ROW_ALIGNMENT * RAW_IMAGE_ROW_ALIGNMENT;
+    header.format = format;
+    header.dataOffset = RAW_IMAGE_DATA_OFFSET;
+    return header;
+}
+
+bool RawImage::readHeader(QString path, RawImageHeader &header) {
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    if(file.read((char*) &header, sizeof(header)) != sizeof(header))
+        return false;
+    if(memcmp(header.magic, RAW_IMAGE_MAGIC, sizeof(header.magic)) != 0)
+        return false;
+    // Everything QImage will read through the mapping has to be inside it:
+    // reject unknown or palette formats, absurd sizes and rows shorter than
+    // the format needs.
+    if(header.format <= QImage::Format_Invalid || header.format >= QImage::NImageFormats)
+        return false;
+    auto format = (QImage::Format) header.format;
+    if(format == QImage::Format_Mono || format == QImage::Format_MonoLSB || format == QImage::Format_Indexed8)
+        return false;
+    if(header.width == 0 || header.height == 0 || header.width > RAW_IMAGE_MAX_SIDE || header.height > RAW_IMAGE_MAX_SIDE)
+        return false;
+    auto rowBytes = (QImage::toPixelFormat(format).bitsPerPixel() * (quint64) header.width + 7) / 8;
+    if(header.bytesPerLine < rowBytes || header.bytesPerLine % 4 != 0)
+        return false;
+    if(header.dataOffset < sizeof(header) || header.dataOffset > (quint64) file.size())
+        return false;
+    return (quint64) file.size() - header.dataOffset >= (quint64) header.bytesPerLine * header.height;
+}
+
+QSize RawImage::size(QString path) {
+    RawImageHeader header;
+    if(!readHeader(path, header))
+        return QSize();
+    return QSize(header.width, header.height);
+}
+
+QImage RawImage::load(QString path) {
+    RawImageHeader header;
+    if(!readHeader(path, header))
+        return QImage();
+    // The QImage owns the file, and with it the mapping, only once it has
+    // been constructed; until then every exit releases it here.
+    std::unique_ptr<QFile> file(new QFile(path));
+    if(!file->open(QIODevice::ReadOnly))
+        return QImage();
+    auto data = file->map(header.dataOffset, (qint64) header.bytesPerLine * header.height);
+    if(data == nullptr)
+        return QImage();
+    QImage image((const uchar*) data, header.width, header.height, header.bytesPerLine, (QImage::Format) header.format, [](void *info) {
+        delete (QFile*) info;
+    }, file.get());
+    if(image.isNull())
+        return QImage();
+    file.release();
+    return image;
+}
+
+bool RawImage::save(QString path, const QImage &image) {
+    auto rawHeader = header(image.size(), image.format());
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    // Header page and rows are streamed through one padded row buffer.
+    QByteArray headerPage(rawHeader.dataOffset, 0);
+    memcpy(headerPage.data(), &rawHeader, sizeof(rawHeader));
+    if(file.write(headerPage) != headerPage.size())
+        return false;
+    QByteArray line(rawHeader.bytesPerLine, 0);
+    auto rowBytes = std::min<qint64>(rawHeader.bytesPerLine, image.bytesPerLine());
+    for(int row = 0; row < image.height(); row++) {
+        memcpy(line.data(), image.constScanLine(row), rowBytes);
+        if(file.write(line) != line.size())
+            return false;
+    }
+    return file.commit();
+}
@@ -0,0 +1,37 @@
+#ifndef RAW_IMAGE_H
+#define RAW_IMAGE_H
+
+#include "definitions.h"
+
+#include <QImage>
+#include <QString>
+
+#define RAW_IMAGE_SUFFIX "fpiraw"
+#define RAW_IMAGE_MAGIC "FPIRAW01"
+#define RAW_IMAGE_DATA_OFFSET 4096
+#define RAW_IMAGE_ROW_ALIGNMENT 64
+#define RAW_IMAGE_MAX_SIDE (1 << 20)
+
+struct RawImageHeader {
+    char magic[8];
+    quint32 width, height;
+    quint32 bytesPerLine;
+    quint32 format;
+    quint64 dataOffset;
+};
+
+// Native uncompressed working format: a header page followed by rows padded
+// to RAW_IMAGE_ROW_ALIGNMENT bytes. Loading maps the file and wraps the
+// mapping in a QImage, so no pixel data is copied or decoded.
+class RawImage {
+public:
+    static bool isRawImage(QString path);
+    static bool readHeader(QString path, RawImageHeader &header);
+    static QSize size(QString path);
+    static QImage load(QString path);
+    static bool save(QString path, const QImage &image);
+
+    static RawImageHeader header(QSize size, QImage::Format format);
+};
+
+#endif // RAW_IMAGE_H
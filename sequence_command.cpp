@@ -0,0 +1,257 @@
+#include "sequence_command.h"
+#include "image_widget.cpp"
+#include "frame_sequence.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QTextStream>
+
+#include <cstring>
+
+using SequenceStep = std::function<void(ImageWidget*)>;
+
+// The parameters of one --op, over the defaults of its operation. The first
+// invalid value is kept in error.
+struct StepParameters {
+    QMap<QString, QString> values;
+    QString error;
+
+    double number(QString key, double minimum, double maximum) {
+        bool ok = false;
+        auto value = values.value(key).toDouble(&ok);
+        if(!ok || value < minimum || value > maximum) {
+            if(error.isEmpty())
+                error = QString("%1 must be a number from %2 to %3").arg(key).arg(minimum).arg(maximum);
+            return minimum;
+        }
+        return value;
+    }
+
+    QString text(QString key, QStringList choices) {
+        auto value = values.value(key);
+        if(!choices.contains(value) && error.isEmpty())
+            error = QString("%1 must be one of %2").arg(key, choices.join(", "));
+        return value;
+    }
+};
+
+struct SequenceOperation {
+    QString name;
+    // key=value pairs separated by ':', the same form --op takes.
+    QString defaults;
+    std::function<SequenceStep(StepParameters&)> build;
+};
+
+static QList<SequenceOperation> sequenceOperations(QString firstFrame) {
+    return {
+        {"grayscale", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->grayscale(); };
+        }},
+        {"negative", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->negative(); };
+        }},
+        {"addBrightness", "amount=20", [](StepParameters &parameters) {
+            int amount = parameters.number("amount", -255, 255);
+            return [amount](ImageWidget *widget) { widget->addBrightness(amount); };
+        }},
+        {"addContrast", "factor=2", [](StepParameters &parameters) {
+            int factor = parameters.number("factor", 0, 255);
+            return [factor](ImageWidget *widget) { widget->addContrast(factor); };
+        }},
+        {"quantize", "tones=8", [](StepParameters &parameters) {
+            int tones = parameters.number("tones", 1, 255);
+            return [tones](ImageWidget *widget) { widget->quantize(tones); };
+        }},
+        {"quantizeColors", "colors=64", [](StepParameters &parameters) {
+            int colors = parameters.number("colors", 1, PALETTE_MAX_COLORS);
+            return [colors](ImageWidget *widget) { widget->quantizeColors(colors); };
+        }},
+        {"equalize", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->equalize(); };
+        }},
+        {"equalizeAdaptive", QString("clip=%1").arg(CLAHE_DEFAULT_CLIP_LIMIT), [](StepParameters &parameters) {
+            auto clip = parameters.number("clip", 0, 256);
+            return [clip](ImageWidget *widget) { widget->equalizeAdaptive(clip); };
+        }},
+        // reference=first matches every frame to the first one, which evens
+        // out flicker in time-lapses; otherwise it is an image file.
+        {"matchHistogram", "reference=first", [firstFrame](StepParameters &parameters) -> SequenceStep {
+            auto path = parameters.values.value("reference");
+            ChannelHistograms reference;
+            if(!ReferenceHistogramCache::instance().histograms(path == "first" ? firstFrame : path, reference)) {
+                parameters.error = "cannot open the reference " + path;
+                return nullptr;
+            }
+            return [reference](ImageWidget *widget) { widget->matchHistogram(reference); };
+        }},
+        {"median", "radius=5", [](StepParameters &parameters) {
+            int radius = parameters.number("radius", 1, RANK_FILTER_MAX_RADIUS);
+            return [radius](ImageWidget *widget) { widget->median(radius); };
+        }},
+        {"rankFilter", "radius=5:percentile=0.5", [](StepParameters &parameters) {
+            int radius = parameters.number("radius", 1, RANK_FILTER_MAX_RADIUS);
+            auto percentile = parameters.number("percentile", 0, 1);
+            return [radius, percentile](ImageWidget *widget) { widget->rankFilter(radius, percentile); };
+        }},
+        {"boxBlur", "radius=5", [](StepParameters &parameters) {
+            int radius = parameters.number("radius", 1, BLUR_MAX_RADIUS);
+            return [radius](ImageWidget *widget) { widget->boxBlur(radius); };
+        }},
+        {"gaussianBlur", "sigma=2", [](StepParameters &parameters) {
+            auto sigma = parameters.number("sigma", GAUSSIAN_MIN_SIGMA, GAUSSIAN_MAX_SIGMA);
+            return [sigma](ImageWidget *widget) { widget->gaussianBlur(sigma); };
+        }},
+        {"bilateral", "spatial=16:range=24", [](StepParameters &parameters) {
+            auto spatial = parameters.number("spatial", BILATERAL_MIN_SPATIAL_SIGMA, BILATERAL_MAX_SPATIAL_SIGMA);
+            auto range = parameters.number("range", BILATERAL_MIN_RANGE_SIGMA, BILATERAL_MAX_RANGE_SIGMA);
+            return [spatial, range](ImageWidget *widget) { widget->bilateral(spatial, range); };
+        }},
+        {"morphology", "operation=erode:radiusX=1:radiusY=1", [](StepParameters &parameters) {
+            static const QStringList names = {"erode", "dilate", "open", "close", "topHat"};
+            auto operation = (MorphologyOperation) names.indexOf(parameters.text("operation", names));
+            int radiusX = parameters.number("radiusX", 0, MORPHOLOGY_MAX_RADIUS);
+            int radiusY = parameters.number("radiusY", 0, MORPHOLOGY_MAX_RADIUS);
+            return [operation, radiusX, radiusY](ImageWidget *widget) { widget->morphology(operation, radiusX, radiusY); };
+        }},
+        // add=auto offsets the result by 127, as the window does, for the
+        // edge kernels whose response is signed.
+        {"convolve", "kernel=gaussian:add=auto", [](StepParameters &parameters) {
+            static const QStringList names = {"gaussian", "laplacian", "highPass", "prewittHx", "prewittHy", "sobelHx", "sobelHy"};
+            static const double (*presets[])[3] = {GAUSSIAN, LAPLACIAN, HIGH_PASS, PREWITT_HX, PREWITT_HY, SOBEL_HX, SOBEL_HY};
+            auto index = std::max<int>(0, names.indexOf(parameters.text("kernel", names)));
+            auto add = parameters.text("add", {"auto", "0", "1"});
+            auto offset = add == "auto" ? index >= 3 : add == "1";
+            std::array<double, 9> kernel;
+            memcpy(kernel.data(), presets[index], sizeof(double) * 9);
+            return [kernel, offset](ImageWidget *widget) {
+                double copy[3][3];
+                memcpy(copy, kernel.data(), sizeof(copy));
+                widget->convolve(copy, offset);
+            };
+        }},
+        {"mirrorVertically", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->mirrorVertically(); };
+        }},
+        {"mirrorHorizontally", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->mirrorHorizontally(); };
+        }},
+        {"rotateLeft", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->rotateLeft(); };
+        }},
+        {"rotateRight", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->rotateRight(); };
+        }},
+        {"zoomOut", "x=2:y=2", [](StepParameters &parameters) {
+            int x = parameters.number("x", 1, 1024);
+            int y = parameters.number("y", 1, 1024);
+            return [x, y](ImageWidget *widget) { widget->zoomOut(x, y); };
+        }},
+        {"zoomIn", "", [](StepParameters &) {
+            return [](ImageWidget *widget) { widget->zoomIn(); };
+        }},
+    };
+}
+
+static QMap<QString, QString> parseParameters(QStringList pairs, QString &error) {
+    QMap<QString, QString> result;
+    for(auto &pair : pairs) {
+        auto separator = pair.indexOf('=');
+        if(separator <= 0) {
+            error = "expected key=value, got " + pair;
+            break;
+        }
+        result[pair.left(separator)] = pair.mid(separator + 1);
+    }
+    return result;
+}
+
+// Turns one --op into a step; on failure returns null and sets error.
+static SequenceStep parseStep(const QList<SequenceOperation> &operations, QString spec, QString &error) {
+    auto parts = spec.split(':');
+    auto name = parts.takeFirst();
+    auto operation = std::find_if(operations.begin(), operations.end(), [&name](const SequenceOperation &candidate) {
+        return candidate.name == name;
+    });
+    if(operation == operations.end()) {
+        error = "unknown operation " + name;
+        return nullptr;
+    }
+    StepParameters parameters;
+    parameters.values = parseParameters(operation->defaults.split(':', Qt::SkipEmptyParts), error);
+    auto given = parseParameters(parts, error);
+    for(auto key = given.constBegin(); key != given.constEnd() && error.isEmpty(); key++) {
+        if(!parameters.values.contains(key.key()))
+            error = QString("%1 has no parameter %2").arg(name, key.key());
+        parameters.values[key.key()] = key.value();
+    }
+    if(!error.isEmpty())
+        return nullptr;
+    auto step = operation->build(parameters);
+    if(!parameters.error.isEmpty()) {
+        error = name + ": " + parameters.error;
+        return nullptr;
+    }
+    return step;
+}
+
+bool isSequenceCommand(int argc, char *argv[]) {
+    for(int i = 1; i < argc; i++)
+        if(!strncmp(argv[i], "--sequence", 10) || !strcmp(argv[i], "--list-ops"))
+            return true;
+    return false;
+}
+
+int runSequenceCommand(QStringList arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs a chain of operations over every frame of an image sequence.");
+    parser.addHelpOption();
+    QCommandLineOption sequenceOption("sequence", "A directory of frames or a numbered pattern (frame_%04d.png, frame_####.png).", "input");
+    QCommandLineOption outputOption("output", "An output directory or numbered pattern.", "output");
+    QCommandLineOption opOption("op", "An operation, name[:key=value...]; repeat for a chain, applied in order.", "operation");
+    QCommandLineOption listOption("list-ops", "Print every operation with its default parameters.");
+    QCommandLineOption qualityOption("quality", "Encoder quality (-1 for the format default).", "value", "-1");
+    QCommandLineOption queueDepthOption("queue-depth", "Frames waiting between two pipeline stages.", "count", QString::number(SEQUENCE_DEFAULT_QUEUE_DEPTH));
+    parser.addOptions({sequenceOption, outputOption, opOption, listOption, qualityOption, queueDepthOption});
+    parser.process(arguments);
+
+    QTextStream out(stdout), err(stderr);
+    if(parser.isSet(listOption)) {
+        for(auto &operation : sequenceOperations(QString()))
+            out << operation.name << (operation.defaults.isEmpty() ? QString() : ":" + operation.defaults) << "\n";
+        return 0;
+    }
+    auto frames = sequenceFrames(parser.value(sequenceOption));
+    if(frames.isEmpty()) {
+        err << "No frames found for " << parser.value(sequenceOption) << "\n";
+        return 1;
+    }
+    if(!parser.isSet(outputOption)) {
+        err << "--sequence needs --output\n";
+        return 1;
+    }
+    auto operations = sequenceOperations(frames[0]);
+    QList<SequenceStep> chain;
+    for(auto &spec : parser.values(opOption)) {
+        QString error;
+        auto step = parseStep(operations, spec, error);
+        if(!step) {
+            err << "--op " << spec << ": " << error << "\n";
+            return 1;
+        }
+        chain << step;
+    }
+    auto total = frames.size();
+    auto result = processSequence(frames, parser.value(outputOption), [chain](QImage image) {
+        auto widget = ImageWidget::createHeadless(image);
+        for(auto &step : chain)
+            step(widget);
+        auto processed = widget->getImage();
+        delete widget;
+        return processed;
+    }, parser.value(qualityOption).toInt(), parser.value(queueDepthOption).toInt(), [total](int written) {
+        QTextStream(stderr) << "\r" << written << "/" << total;
+    });
+    err << "\n";
+    out << result.toString() << "\n";
+    return result.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+#ifndef SEQUENCE_COMMAND_H
+#define SEQUENCE_COMMAND_H
+
+#include <QStringList>
+
+// FPI1 --sequence <input> --output <output> --op <operation>...
+// runs a chain of ImageWidget operations over every frame of a directory or
+// numbered pattern through processSequence, without opening a window.
+// Each --op is a name optionally followed by parameters, such as
+// median:radius=9 or convolve:kernel=sobelHx:add=1; --list-ops prints them
+// all with their defaults.
+bool isSequenceCommand(int argc, char *argv[]);
+// Needs a QCoreApplication. Returns the process exit code.
+int runSequenceCommand(QStringList arguments);
+
+#endif // SEQUENCE_COMMAND_H
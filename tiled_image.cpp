@@ -0,0 +1,358 @@
+#include "tiled_image.h"
+#include "buffer_pool.h"
+#include "raw_image.h"
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QPainter>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include <atomic>
+#include <cctype>
+
+TiledImage::TiledImage(QSize size, qint64 memoryBudget) {
+    this->imageSize = size;
+    this->memoryBudget = memoryBudget;
+    this->store = new QTemporaryFile;
+    cache.setMaxCost(memoryBudget / 2);
+    previewScale = std::min(1.0, TILED_PREVIEW_SIZE / (double) std::max(size.width(), size.height()));
+    previewImage = QImage(std::max(1, (int) (size.width() * previewScale)), std::max(1, (int) (size.height() * previewScale)), QImage::Format_RGB32);
+}
+
+TiledImage::~TiledImage() {
+    delete store;
+}
+
+qint64 TiledImage::defaultMemoryBudget() {
+    bool ok = false;
+    auto megabytes = qEnvironmentVariableIntValue("FPI_MEMORY_BUDGET_MB", &ok);
+    if(ok && megabytes > 0)
+        return (qint64) megabytes * 1024 * 1024;
+    return DEFAULT_MEMORY_BUDGET;
+}
+
+// Parses a binary (P6) PPM header with a maximum value of 255 and leaves
+// the file at the first pixel.
+static bool readPpmHeader(QFile &file, QSize &size) {
+    if(file.read(2) != "P6")
+        return false;
+    int values[3];
+    for(auto &value : values) {
+        char c;
+        do {
+            if(!file.getChar(&c))
+                return false;
+            if(c == '#') {
+                file.readLine();
+                c = ' ';
+            }
+        } while(isspace((unsigned char) c));
+        value = 0;
+        while(isdigit((unsigned char) c)) {
+            value = value * 10 + (c - '0');
+            if(value > (1 << 24) || !file.getChar(&c))
+                return false;
+        }
+        if(!isspace((unsigned char) c))
+            return false;
+    }
+    size = QSize(values[0], values[1]);
+    return values[0] > 0 && values[1] > 0 && values[2] == 255;
+}
+
+TiledImage *TiledImage::open(QString imagePath, qint64 memoryBudget) {
+    QImageReader probe(imagePath);
+    QFile ppm(imagePath);
+    QSize ppmSize;
+    auto raw = RawImage::isRawImage(imagePath);
+    auto streamed = !raw && probe.format() == "ppm" && ppm.open(QIODevice::ReadOnly) && readPpmHeader(ppm, ppmSize);
+    auto size = raw ? RawImage::size(imagePath) : streamed ? ppmSize : probe.size();
+    if(!size.isValid())
+        return nullptr;
+    auto result = new TiledImage(size, memoryBudget);
+    if(!result->store->open() || !result->store->resize(result->tileOffset(result->columns() * result->rows()))) {
+        delete result;
+        return nullptr;
+    }
+    // Bands are as many tile rows as half the budget holds.
+    auto bandRows = (int) std::clamp<qint64>(memoryBudget / 2 / ((qint64) size.width() * TILE_SIZE * sizeof(QRgb)), 1, result->rows());
+    bool loaded;
+    if(raw) {
+        // The raw file is mapped, so tiles are copied out of the page cache.
+        loaded = result->writeBand(RawImage::load(imagePath), 0);
+    } else if(streamed) {
+        loaded = result->readPpm(ppm, bandRows);
+    } else if(probe.supportsOption(QImageIOHandler::ClipRect)) {
+        // QImageReader cannot resume after read(), so every band decodes the
+        // file from the top again. Tall bands keep that to a few passes, and
+        // a single one when the image fits.
+        loaded = true;
+        for(int row = 0; loaded && row < result->rows(); row += bandRows) {
+            QImageReader reader(imagePath);
+            auto top = row * TILE_SIZE;
+            reader.setClipRect(QRect(0, top, size.width(), std::min(bandRows * TILE_SIZE, size.height() - top)));
+            loaded = result->writeBand(reader.read(), row);
+        }
+    } else if((qint64) size.width() * size.height() * sizeof(QRgb) <= memoryBudget) {
+        loaded = result->writeBand(probe.read(), 0);
+    } else {
+        qWarning("%s: %s images cannot be decoded in bands and this one exceeds the memory budget",
+                 qPrintable(imagePath), probe.format().constData());
+        loaded = false;
+    }
+    if(!loaded) {
+        delete result;
+        return nullptr;
+    }
+    return result;
+}
+
+bool TiledImage::readPpm(QFile &file, int bandRows) {
+    QByteArray line(width() * 3, 0);
+    for(int row = 0; row < rows(); row += bandRows) {
+        auto top = row * TILE_SIZE;
+        QImage band(width(), std::min(bandRows * TILE_SIZE, height() - top), QImage::Format_RGB32);
+        for(int y = 0; y < band.height(); y++) {
+            if(file.read(line.data(), line.size()) != line.size())
+                return false;
+            auto in = (const BYTE*) line.constData();
+            auto out = (QRgb*) band.scanLine(y);
+            for(int x = 0; x < width(); x++, in += 3)
+                out[x] = qRgb(in[0], in[1], in[2]);
+        }
+        if(!writeBand(band, row))
+            return false;
+    }
+    return true;
+}
+
+bool TiledImage::writeBand(const QImage &band, int firstRow) {
+    if(band.isNull())
+        return false;
+    auto top = firstRow * TILE_SIZE;
+    for(int row = firstRow; row < rows() && row * TILE_SIZE < top + band.height(); row++)
+        for(int column = 0; column < columns(); column++)
+            if(!writeTile(column, row, band.copy(tileRect(column, row).translated(0, -top))))
+                return false;
+    return true;
+}
+
+QRect TiledImage::tileRect(int column, int row) const {
+    auto x = column * TILE_SIZE;
+    auto y = row * TILE_SIZE;
+    return QRect(x, y, std::min(TILE_SIZE, width() - x), std::min(TILE_SIZE, height() - y));
+}
+
+QImage TiledImage::readTile(int column, int row) {
+    auto index = tileIndex(column, row);
+    {
+        QMutexLocker locker(&cacheMutex);
+        if(auto cached = cache.object(index))
+            return *cached;
+    }
+    auto tile = readTile(store, column, row);
+    if(tile.isNull())
+        return tile;
+    QMutexLocker locker(&cacheMutex);
+    cache.insert(index, new QImage(tile), tile.sizeInBytes());
+    return tile;
+}
+
+QImage TiledImage::readTile(QTemporaryFile *file, int column, int row) {
+    auto rect = tileRect(column, row);
+    auto tile = BufferPool::instance().image(rect.width(), rect.height(), QImage::Format_RGB32);
+    QMutexLocker locker(&ioMutex);
+    if(!file->seek(tileOffset(tileIndex(column, row))) || file->read((char*) tile.bits(), tile.sizeInBytes()) != tile.sizeInBytes()) {
+        qWarning("Could not read tile %d,%d: %s", column, row, qPrintable(file->errorString()));
+        return QImage();
+    }
+    return tile;
+}
+
+bool TiledImage::writeTile(int column, int row, const QImage &tile) {
+    auto written = writeTile(store, column, row, tile);
+    QMutexLocker locker(&cacheMutex);
+    cache.remove(tileIndex(column, row));
+    return written;
+}
+
+bool TiledImage::writeTile(QTemporaryFile *file, int column, int row, const QImage &tile) {
+    auto rect = tileRect(column, row);
+    if(tile.size() != rect.size())
+        return false;
+    auto converted = tile.convertToFormat(QImage::Format_RGB32);
+    {
+        QMutexLocker locker(&ioMutex);
+        if(!file->seek(tileOffset(tileIndex(column, row)))
+           || file->write((const char*) converted.constBits(), converted.sizeInBytes()) != converted.sizeInBytes()) {
+            qWarning("Could not write tile %d,%d: %s", column, row, qPrintable(file->errorString()));
+            return false;
+        }
+    }
+    paintPreview(column, row, converted);
+    return true;
+}
+
+void TiledImage::paintPreview(int column, int row, const QImage &tile) {
+    auto rect = tileRect(column, row);
+    auto target = QRectF(rect.x() * previewScale, rect.y() * previewScale, rect.width() * previewScale, rect.height() * previewScale);
+    QMutexLocker locker(&previewMutex);
+    QPainter painter(&previewImage);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(target, tile);
+}
+
+QImage TiledImage::readRegion(QRect rect) {
+    rect = rect.intersected(QRect(QPoint(0, 0), imageSize));
+    auto region = BufferPool::instance().image(rect.width(), rect.height(), QImage::Format_RGB32);
+    QPainter painter(&region);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for(int row = rect.top() / TILE_SIZE; row <= rect.bottom() / TILE_SIZE; row++) {
+        for(int column = rect.left() / TILE_SIZE; column <= rect.right() / TILE_SIZE; column++) {
+            auto source = tileRect(column, row);
+            auto overlap = source.intersected(rect);
+            auto tile = readTile(column, row);
+            if(tile.isNull())
+                return QImage();
+            painter.drawImage(overlap.topLeft() - rect.topLeft(), tile, overlap.translated(-source.topLeft()));
+        }
+    }
+    return region;
+}
+
+int TiledImage::concurrency(qint64 bytesPerTask) const {
+    auto workerBudget = memoryBudget - cache.maxCost();
+    auto tasks = std::max<qint64>(1, workerBudget / std::max<qint64>(1, bytesPerTask));
+    return (int) std::min<qint64>(tasks, QThread::idealThreadCount());
+}
+
+bool TiledImage::runOnTiles(qint64 bytesPerTask, std::function<bool(int, int)> action) {
+    QList<int> indices;
+    for(int i = 0; i < columns() * rows(); i++)
+        indices << i;
+    QThreadPool pool;
+    pool.setMaxThreadCount(concurrency(bytesPerTask));
+    auto tileColumns = columns();
+    std::atomic<bool> succeeded{true};
+    QtConcurrent::blockingMap(&pool, indices, [tileColumns, &action, &succeeded](int index) {
+        if(succeeded && !action(index % tileColumns, index / tileColumns))
+            succeeded = false;
+    });
+    return succeeded;
+}
+
+bool TiledImage::forEachTile(std::function<void(QImage)> action) {
+    return runOnTiles(2 * TILE_SIZE * TILE_SIZE * sizeof(QRgb), [this, &action](int column, int row) {
+        auto tile = readTile(store, column, row);
+        if(tile.isNull())
+            return false;
+        action(tile);
+        return true;
+    });
+}
+
+bool TiledImage::mapTiles(std::function<QImage(QImage)> action) {
+    QWriteLocker saving(&saveLock);
+    return runOnTiles(3 * TILE_SIZE * TILE_SIZE * sizeof(QRgb), [this, &action](int column, int row) {
+        auto tile = readTile(store, column, row);
+        return !tile.isNull() && writeTile(column, row, action(tile));
+    });
+}
+
+bool TiledImage::mapRegions(int halo, std::function<QImage(QImage)> action) {
+    QWriteLocker saving(&saveLock);
+    auto target = new QTemporaryFile;
+    if(!target->open() || !target->resize(store->size())) {
+        delete target;
+        return false;
+    }
+    auto side = TILE_SIZE + 2 * halo;
+    auto succeeded = runOnTiles(3 * side * side * sizeof(QRgb), [this, halo, target, &action](int column, int row) {
+        auto rect = tileRect(column, row);
+        auto region = rect.adjusted(-halo, -halo, halo, halo).intersected(QRect(QPoint(0, 0), imageSize));
+        auto source = readRegion(region);
+        if(source.isNull())
+            return false;
+        auto result = action(source);
+        return writeTile(target, column, row, result.copy(QRect(rect.topLeft() - region.topLeft(), rect.size())));
+    });
+    // On failure the original store is kept, and the preview, which already
+    // shows some of the new tiles, is repainted from it.
+    if(!succeeded) {
+        delete target;
+        for(int row = 0; row < rows(); row++)
+            for(int column = 0; column < columns(); column++) {
+                auto tile = readTile(store, column, row);
+                if(!tile.isNull())
+                    paintPreview(column, row, tile);
+            }
+        return false;
+    }
+    delete store;
+    store = target;
+    QMutexLocker locker(&cacheMutex);
+    cache.clear();
+    return true;
+}
+
+QImage TiledImage::preview() {
+    QMutexLocker locker(&previewMutex);
+    return previewImage.copy();
+}
+
+bool TiledImage::save(QString path, EncoderSettings settings) {
+    QReadLocker saving(&saveLock);
+    auto suffix = QFileInfo(path).suffix().toLower();
+    auto raw = RawImage::isRawImage(path);
+    if(suffix != "ppm" && !raw) {
+        if((qint64) width() * height() * sizeof(QRgb) > memoryBudget)
+            return false;
+        return ImageEncoder::encode(readRegion(QRect(QPoint(0, 0), imageSize)), path, settings);
+    }
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    auto rawHeader = RawImage::header(imageSize, QImage::Format_RGB32);
+    QByteArray line;
+    if(raw) {
+        QByteArray headerPage(rawHeader.dataOffset, 0);
+        memcpy(headerPage.data(), &rawHeader, sizeof(rawHeader));
+        if(file.write(headerPage) != headerPage.size())
+            return false;
+        line = QByteArray(rawHeader.bytesPerLine, 0);
+    } else {
+        auto header = QString("P6\n%1 %2\n255\n").arg(width()).arg(height()).toLatin1();
+        if(file.write(header) != header.size())
+            return false;
+        line = QByteArray(width() * 3, 0);
+    }
+    for(int row = 0; row < rows(); row++) {
+        QList<QImage> band;
+        for(int column = 0; column < columns(); column++) {
+            band << readTile(store, column, row);
+            if(band.last().isNull())
+                return false;
+        }
+        for(int y = 0; y < tileRect(0, row).height(); y++) {
+            auto out = (BYTE*) line.data();
+            for(auto &tile : band) {
+                auto pixels = (const QRgb*) tile.constScanLine(y);
+                if(raw) {
+                    memcpy(out, pixels, tile.width() * sizeof(QRgb));
+                    out += tile.width() * sizeof(QRgb);
+                    continue;
+                }
+                for(int x = 0; x < tile.width(); x++) {
+                    *out++ = qRed(pixels[x]);
+                    *out++ = qGreen(pixels[x]);
+                    *out++ = qBlue(pixels[x]);
+                }
+            }
+            if(file.write(line) != line.size())
+                return false;
+        }
+    }
+    return file.commit();
+}
@@ -0,0 +1,100 @@
+#ifndef TILED_IMAGE_H
+#define TILED_IMAGE_H
+
+#include "definitions.h"
+#include "encoder.h"
+
+#include <QCache>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QTemporaryFile>
+
+#include <functional>
+
+// Out-of-core RGB32 image split into TILE_SIZE x TILE_SIZE tiles kept in a
+// temporary file. Tiles are paged in on demand through an LRU cache, and the
+// map operations never hold more than the memory budget worth of pixels. A
+// downscaled preview is kept up to date as tiles are written. Images are
+// decoded into the store in bands: raw files through their mapping, binary
+// PPM by streaming rows, formats with clip-rect support (JPEG) through
+// clipped reads. Other formats, such as PNG, can only be opened when a full
+// decode fits the memory budget.
+class TiledImage {
+public:
+    static TiledImage *open(QString imagePath, qint64 memoryBudget);
+    static qint64 defaultMemoryBudget();
+
+    ~TiledImage();
+
+    int width() const {
+        return imageSize.width();
+    }
+
+    int height() const {
+        return imageSize.height();
+    }
+
+    int columns() const {
+        return (width() + TILE_SIZE - 1) / TILE_SIZE;
+    }
+
+    int rows() const {
+        return (height() + TILE_SIZE - 1) / TILE_SIZE;
+    }
+
+    QRect tileRect(int column, int row) const;
+
+    QImage readTile(int column, int row);
+    QImage readRegion(QRect rect);
+    bool writeTile(int column, int row, const QImage &tile);
+
+    // Tile I/O failures are reported through the return values: readTile()
+    // and readRegion() return a null image, the rest false.
+    bool forEachTile(std::function<void(QImage)> action);
+    bool mapTiles(std::function<QImage(QImage)> action);
+    bool mapRegions(int halo, std::function<QImage(QImage)> action);
+
+    QImage preview();
+    // PPM and raw files are written band by band; other formats go through
+    // ImageEncoder with settings and need the whole image within the memory
+    // budget.
+    bool save(QString path, EncoderSettings settings);
+
+private:
+    QSize imageSize;
+    qint64 memoryBudget;
+    QTemporaryFile *store;
+    QMutex ioMutex;
+    QMutex cacheMutex;
+    QCache<int, QImage> cache;
+    // Held for reading by saves and for writing by mapTiles and mapRegions,
+    // so a save running on the encoder pool never sees tiles change or the
+    // store replaced underneath it.
+    QReadWriteLock saveLock;
+    QMutex previewMutex;
+    QImage previewImage;
+    double previewScale;
+
+    TiledImage(QSize size, qint64 memoryBudget);
+
+    int tileIndex(int column, int row) const {
+        return row * columns() + column;
+    }
+
+    qint64 tileOffset(int index) const {
+        return (qint64) index * TILE_SIZE * TILE_SIZE * sizeof(QRgb);
+    }
+
+    int concurrency(qint64 bytesPerTask) const;
+    QImage readTile(QTemporaryFile *file, int column, int row);
+    bool writeTile(QTemporaryFile *file, int column, int row, const QImage &tile);
+    // Splits band, whose top is tile row firstRow, into tiles.
+    bool writeBand(const QImage &band, int firstRow);
+    void paintPreview(int column, int row, const QImage &tile);
+    bool readPpm(QFile &file, int bandRows);
+    bool runOnTiles(qint64 bytesPerTask, std::function<bool(int, int)> action);
+};
+
+#endif // TILED_IMAGE_H
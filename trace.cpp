@@ -0,0 +1,136 @@
+#include "trace.h"
+#include "buffer_pool.h"
+
+#include <QFile>
+#include <QThread>
+
+#include <algorithm>
+
+struct ActiveOperation {
+    const char *name = nullptr;
+    int depth = 0;
+    qint64 start = 0;
+    qint64 baselineBytes = 0;
+    OperationSummary summary;
+};
+
+static thread_local ActiveOperation active;
+
+QString OperationSummary::toString() const {
+    QStringList parts;
+    for(auto phase = phases.constBegin(); phase != phases.constEnd(); phase++)
+        parts << QString("%1 %2 ms").arg(phase.key()).arg(phase.value() / 1e6, 0, 'f', 1);
+    return QString("%1: %2 ms (%3), %4 MP, %5 MB peak")
+        .arg(name)
+        .arg(wallTime / 1e6, 0, 'f', 1)
+        .arg(parts.join(", "))
+        .arg(pixels / 1e6, 0, 'f', 1)
+        .arg(peakBytes / (1024.0 * 1024.0), 0, 'f', 0);
+}
+
+Trace::Trace() {
+    clock.start();
+    tracePath = qEnvironmentVariable("FPI_TRACE_FILE");
+}
+
+Trace &Trace::instance() {
+    static Trace trace;
+    return trace;
+}
+
+void Trace::setListener(std::function<void(OperationSummary)> listener) {
+    QMutexLocker locker(&mutex);
+    this->listener = listener;
+}
+
+void Trace::beginOperation(const char *name, qint64 pixels) {
+    if(active.depth++ > 0)
+        return;
+    active.name = name;
+    active.start = now();
+    active.summary = OperationSummary();
+    active.summary.name = name;
+    active.summary.pixels = pixels;
+    active.baselineBytes = BufferPool::instance().resetPeak();
+}
+
+void Trace::endOperation() {
+    if(--active.depth > 0)
+        return;
+    auto end = now();
+    active.summary.wallTime = end - active.start;
+    active.summary.peakBytes = std::max<qint64>(0, BufferPool::instance().statistics().peakBytes - active.baselineBytes);
+    std::function<void(OperationSummary)> notify;
+    {
+        QMutexLocker locker(&mutex);
+        if(isRecording())
+            events << TraceEvent{active.name, "operation", active.start, end - active.start, (quintptr) QThread::currentThreadId()};
+        notify = listener;
+    }
+    if(notify)
+        notify(active.summary);
+}
+
+void Trace::addPhase(const char *name, const char *category, qint64 start, qint64 duration) {
+    if(active.depth > 0)
+        active.summary.phases[category] += duration;
+    if(!isRecording())
+        return;
+    QMutexLocker locker(&mutex);
+    events << TraceEvent{name, category, start, duration, (quintptr) QThread::currentThreadId()};
+}
+
+qint64 Trace::milestone(const char *name) {
+    auto elapsed = now();
+    if(isRecording()) {
+        qInfo("%s after %.1f ms", name, elapsed / 1e6);
+        QMutexLocker locker(&mutex);
+        events << TraceEvent{name, "startup", 0, elapsed, (quintptr) QThread::currentThreadId()};
+    }
+    return elapsed;
+}
+
+bool Trace::writeChromeTrace() {
+    if(!isRecording())
+        return false;
+    return writeChromeTrace(tracePath);
+}
+
+bool Trace::writeChromeTrace(QString path) {
+    QFile file(path);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+    QMutexLocker locker(&mutex);
+    file.write("{\"traceEvents\": [\n");
+    for(int i = 0; i < events.size(); i++) {
+        auto &event = events[i];
+        file.write(QString("{\"name\": \"%1\", \"cat\": \"%2\", \"ph\": \"X\", \"ts\": %3, \"dur\": %4, \"pid\": 1, \"tid\": %5}%6\n")
+                       .arg(QString::fromLatin1(event.name), QString::fromLatin1(event.category))
+                       .arg(event.start / 1e3, 0, 'f', 3)
+                       .arg(event.duration / 1e3, 0, 'f', 3)
+                       .arg(event.thread)
+                       .arg(QString(i + 1 < events.size() ? "," : ""))
+                       .toUtf8());
+    }
+    file.write("]}\n");
+    return true;
+}
+
+TraceScope::TraceScope(const char *name, const char *category) {
+    this->name = name;
+    this->category = category;
+    this->start = Trace::instance().now();
+}
+
+TraceScope::~TraceScope() {
+    auto &trace = Trace::instance();
+    trace.addPhase(name, category, start, trace.now() - start);
+}
+
+OperationTrace::OperationTrace(const char *name, qint64 pixels) {
+    Trace::instance().beginOperation(name, pixels);
+}
+
+OperationTrace::~OperationTrace() {
+    Trace::instance().endOperation();
+}
@@ -0,0 +1,87 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+
+#include <functional>
+
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    qint64 start, duration;
+    quintptr thread;
+};
+
+struct OperationSummary {
+    QString name;
+    qint64 wallTime = 0;
+    QMap<QString, qint64> phases;
+    qint64 pixels = 0;
+    // High-water mark of BufferPool bytes in use during the operation,
+    // above what was already in use when it began. The pool is shared, so
+    // buffers taken by other threads meanwhile count too, and allocations
+    // made outside the pool are not seen.
+    qint64 peakBytes = 0;
+
+    QString toString() const;
+};
+
+// Process-wide recorder for operation timings. Phases are attributed to the
+// outermost operation running on the same thread. Individual events are only
+// kept when a Chrome trace file was requested through FPI_TRACE_FILE.
+class Trace {
+public:
+    static Trace &instance();
+
+    bool isRecording() const {
+        return !tracePath.isEmpty();
+    }
+
+    qint64 now() const {
+        return clock.nsecsElapsed();
+    }
+
+    void setListener(std::function<void(OperationSummary)> listener);
+    void beginOperation(const char *name, qint64 pixels);
+    void endOperation();
+    void addPhase(const char *name, const char *category, qint64 start, qint64 duration);
+    // Returns the time since the trace clock started, which is process
+    // start for the GUI, and when recording adds it to the trace and logs
+    // it. Used for startup checkpoints such as the first image pixel on
+    // screen.
+    qint64 milestone(const char *name);
+    bool writeChromeTrace();
+    bool writeChromeTrace(QString path);
+
+private:
+    QElapsedTimer clock;
+    QString tracePath;
+    QMutex mutex;
+    QList<TraceEvent> events;
+    std::function<void(OperationSummary)> listener;
+
+    Trace();
+};
+
+class TraceScope {
+public:
+    TraceScope(const char *name, const char *category = "compute");
+    ~TraceScope();
+
+private:
+    const char *name;
+    const char *category;
+    qint64 start;
+};
+
+class OperationTrace {
+public:
+    OperationTrace(const char *name, qint64 pixels);
+    ~OperationTrace();
+};
+
+#endif // TRACE_H